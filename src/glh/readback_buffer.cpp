@@ -0,0 +1,67 @@
+#include "readback_buffer.hpp"
+
+#include <cassert>
+#include <cstring>
+
+#include <glad/glad.h>
+
+GlReadbackBuffer::GlReadbackBuffer(uint64_t size, uint32_t num_copies)
+    : size_(size), fences_(num_copies, nullptr), data_(size, 0) {
+    const auto flags = GL_MAP_READ_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+    buffer_ = std::make_unique<GlBuffer>(size * num_copies, flags);
+    mapped_ptr_ = reinterpret_cast<const uint8_t *>(glMapNamedBufferRange(buffer_->Id(), 0, buffer_->Size(), flags));
+}
+
+GlReadbackBuffer::~GlReadbackBuffer() {
+    for (auto fence : fences_) {
+        if (fence) {
+            glDeleteSync(reinterpret_cast<GLsync>(fence));
+        }
+    }
+    glUnmapNamedBuffer(buffer_->Id());
+}
+
+void GlReadbackBuffer::Copy(uint32_t src, uint64_t src_offset, uint64_t dst_offset, uint64_t size) {
+    assert(dst_offset + size <= size_);
+    if (!recording_) {
+        recording_ = true;
+        dropping_ = num_in_flight_ == fences_.size() && (Poll(), num_in_flight_ == fences_.size());
+    }
+    if (dropping_) {
+        return;
+    }
+    const auto copy = (oldest_copy_ + num_in_flight_) % fences_.size();
+    glCopyNamedBufferSubData(src, buffer_->Id(), src_offset, copy * size_ + dst_offset, size);
+}
+
+void GlReadbackBuffer::Submit() {
+    if (!recording_) {
+        return;
+    }
+    recording_ = false;
+    if (dropping_) {
+        return;
+    }
+    const auto copy = (oldest_copy_ + num_in_flight_) % fences_.size();
+    fences_[copy] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    ++num_in_flight_;
+}
+
+bool GlReadbackBuffer::Poll() {
+    bool arrived = false;
+    while (num_in_flight_ > 0) {
+        auto fence = reinterpret_cast<GLsync>(fences_[oldest_copy_]);
+        // a zero timeout never blocks, the flush makes sure the fence is eventually reached
+        const auto status = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 0);
+        if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED) {
+            break;
+        }
+        glDeleteSync(fence);
+        fences_[oldest_copy_] = nullptr;
+        std::memcpy(data_.data(), mapped_ptr_ + oldest_copy_ * size_, size_);
+        oldest_copy_ = (oldest_copy_ + 1) % fences_.size();
+        --num_in_flight_;
+        arrived = true;
+    }
+    return arrived;
+}
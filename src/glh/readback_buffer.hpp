@@ -0,0 +1,46 @@
+#pragma once
+
+#include <memory>
+#include <vector>
+
+#include "resource.hpp"
+
+// Results the CPU reads back from the GPU without waiting for it. The copies of a frame go to one of
+// `num_copies` persistently mapped copies and are fenced at the end of the frame, a copy is collected once its
+// fence has signaled, so results arrive one or two frames late. The copies of a frame are dropped if all copies
+// are still in flight.
+class GlReadbackBuffer {
+public:
+    GlReadbackBuffer(uint64_t size, uint32_t num_copies);
+    ~GlReadbackBuffer();
+
+    uint64_t Size() const { return size_; }
+
+    // copies `size` bytes at `src_offset` of buffer `src` to `dst_offset` of the copy of this frame
+    void Copy(uint32_t src, uint64_t src_offset, uint64_t dst_offset, uint64_t size);
+    // fences the copies of this frame, called after the last copy of a frame
+    void Submit();
+
+    // collects the copies the GPU is done with without waiting, returns true if newer results arrived
+    bool Poll();
+
+    // results of the newest collected copy, zeros until the first copy is collected
+    template <typename T>
+    const T *TypedData() const {
+        return reinterpret_cast<const T *>(data_.data());
+    }
+
+private:
+    std::unique_ptr<GlBuffer> buffer_;
+    const uint8_t *mapped_ptr_ = nullptr;
+    uint64_t size_;
+
+    // GLsync of each copy, copies in flight follow the oldest one
+    std::vector<void *> fences_;
+    uint32_t oldest_copy_ = 0;
+    uint32_t num_in_flight_ = 0;
+    bool recording_ = false;
+    bool dropping_ = false;
+
+    std::vector<uint8_t> data_;
+};
@@ -0,0 +1,51 @@
+#include "ring_buffer.hpp"
+
+#include <cassert>
+#include <cstring>
+
+#include <glad/glad.h>
+
+GlRingBuffer::GlRingBuffer(uint64_t segment_size, uint32_t num_segments)
+    : segment_size_(segment_size), fences_(num_segments, nullptr) {
+    const auto flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+    buffer_ = std::make_unique<GlBuffer>(segment_size * num_segments, flags);
+    mapped_ptr_ = reinterpret_cast<uint8_t *>(glMapNamedBufferRange(buffer_->Id(), 0, buffer_->Size(), flags));
+}
+
+GlRingBuffer::~GlRingBuffer() {
+    for (auto fence : fences_) {
+        if (fence) {
+            glDeleteSync(reinterpret_cast<GLsync>(fence));
+        }
+    }
+    glUnmapNamedBuffer(buffer_->Id());
+}
+
+uint64_t GlRingBuffer::Push(const void *data, uint64_t size, uint64_t alignment) {
+    assert(size <= segment_size_);
+    auto offset = (curr_offset_ + alignment - 1) / alignment * alignment;
+    if (offset + size > segment_size_) {
+        NextSegment();
+        offset = 0;
+    }
+    curr_offset_ = offset + size;
+
+    offset += curr_segment_ * segment_size_;
+    std::memcpy(mapped_ptr_ + offset, data, size);
+    return offset;
+}
+
+void GlRingBuffer::NextSegment() {
+    if (curr_offset_ == 0) {
+        return;
+    }
+    fences_[curr_segment_] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    curr_segment_ = (curr_segment_ + 1) % fences_.size();
+    curr_offset_ = 0;
+
+    if (auto fence = reinterpret_cast<GLsync>(fences_[curr_segment_])) {
+        while (glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000) == GL_TIMEOUT_EXPIRED) {}
+        glDeleteSync(fence);
+        fences_[curr_segment_] = nullptr;
+    }
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <memory>
+#include <vector>
+
+#include "resource.hpp"
+
+// A persistently and coherently mapped buffer split into `num_segments` segments that are filled one after
+// another. The CPU writes into the current segment while the GPU may still read the others, a fence guards each
+// segment and is waited on before the segment is reused, so nothing is overwritten while in flight.
+class GlRingBuffer {
+public:
+    GlRingBuffer(uint64_t segment_size, uint32_t num_segments);
+    ~GlRingBuffer();
+
+    uint32_t Id() const { return buffer_->Id(); }
+
+    // copies `size` bytes of `data` into the current segment at an offset aligned to `alignment` and returns the
+    // offset, moves to the next segment first if the current one is full
+    uint64_t Push(const void *data, uint64_t size, uint64_t alignment);
+    template <typename T>
+    uint64_t Push(const T &value, uint64_t alignment) {
+        return Push(&value, sizeof(T), alignment);
+    }
+
+    // fences the commands issued so far, which read the current segment, and moves to the next segment,
+    // waiting until the GPU is done with it. called at the end of a frame
+    void NextSegment();
+
+private:
+    std::unique_ptr<GlBuffer> buffer_;
+    uint8_t *mapped_ptr_ = nullptr;
+
+    uint64_t segment_size_;
+    uint32_t curr_segment_ = 0;
+    uint64_t curr_offset_ = 0;
+    // GLsync of each segment, null if the segment is not in flight
+    std::vector<void *> fences_;
+};
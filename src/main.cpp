@@ -1,8 +1,12 @@
 #include <string>
 #include <iostream>
 #include <fstream>
+#include <random>
+#include <algorithm>
+#include <iterator>
 
 #include <imgui.h>
+#include <glm/gtc/matrix_transform.hpp>
 
 #include "defines.hpp"
 #include "renderer/renderer.hpp"
@@ -38,8 +42,37 @@ int main(int argc, char **argv) {
         Renderer::CreateRenderer(rasterizer, scene, RendererType::eBasic),
         Renderer::CreateRenderer(rasterizer, scene, RendererType::eSimpleHiZ),
         Renderer::CreateRenderer(rasterizer, scene, RendererType::eOctreeHiZ),
+        Renderer::CreateRenderer(rasterizer, scene, RendererType::eClusterHiZ),
+        Renderer::CreateRenderer(rasterizer, scene, RendererType::eBvhHiZ),
     };
     auto renderer = renderers[static_cast<size_t>(curr_renderer_type)].get();
+    // dirty instances not uploaded yet by each renderer, only the current one is updated every frame and the others
+    // catch up when they are selected
+    std::vector<uint32_t> pending_dirty_instances[std::size(renderers)];
+
+    // every few instances orbit around their original position when animation is enabled
+    constexpr uint32_t kAnimatedInstanceStride = 8;
+    bool animate_instances = false;
+    float contribution_cull_scale = 1.0f;
+    float max_lod_error = 1.0f;
+    // fragment counts of the last frame drawn in each order, shown side by side to compare the overdraw
+    bool front_to_back = false;
+    bool collect_stats = false;
+    Rasterizer::FrameStats order_stats[2] {};
+    const float animation_radius = scene.Extent() * 0.05f;
+    std::vector<Scene::InstanceHandle> animated_instances;
+    std::vector<glm::mat4> animated_base_transforms;
+    for (uint32_t i = 0; i < scene.InstancesCount(); i += kAnimatedInstanceStride) {
+        if (scene.GetInstance(i).alive) {
+            animated_instances.push_back(scene.GetInstanceHandle(i));
+            animated_base_transforms.push_back(scene.GetInstance(i).transform);
+        }
+    }
+    // instances added at runtime go to the free slots reserved by the scene file, at random places in the scene
+    const bool has_free_slots = scene.AliveInstancesCount() != scene.InstancesCount();
+    std::mt19937 add_random(0);
+    const auto add_bbox = scene.Bbox();
+    std::vector<Scene::InstanceHandle> added_instances;
 
     auto color_buffer = std::make_unique<GlTexture2D>(GL_RGBA8, window_width, window_height, 1);
     auto depth_buffer = std::make_unique<GlTexture2D>(GL_R32F, window_width, window_height, 1);
@@ -47,6 +80,15 @@ int main(int argc, char **argv) {
     rasterizer.SetColorTarget(color_buffer.get());
     rasterizer.SetDepthTarget(depth_buffer.get());
 
+    // a frame is only rendered again if the camera, the scene, the renderer or a setting changed,
+    // otherwise the color buffer of the last frame is presented again
+    bool skip_unchanged_frames = true;
+    bool frame_dirty = true;
+    bool ui_was_active = false;
+    glm::mat4 last_view(0.0f);
+    glm::mat4 last_proj(0.0f);
+    const Renderer *last_renderer = nullptr;
+
     window.SetResizeCallback([&](uint32_t width, uint32_t height) {
         window_width = width;
         window_height = height;
@@ -59,6 +101,7 @@ int main(int argc, char **argv) {
         rasterizer.SetViewport(window_width, window_height);
         rasterizer.SetColorTarget(color_buffer.get());
         rasterizer.SetDepthTarget(depth_buffer.get());
+        frame_dirty = true;
     });
 
     window.SetMouseCallback([&](uint32_t state, float x, float y, float last_x, float last_y) {
@@ -112,12 +155,56 @@ int main(int argc, char **argv) {
     glCreateVertexArrays(1, &empty_vao);
 
     window.MainLoop([&]() {
-        rasterizer.ClearBuffers();
+        if (animate_instances) {
+            const auto time = static_cast<float>(ImGui::GetTime());
+            for (size_t i = 0; i < animated_instances.size(); i++) {
+                const float phase = time + i;
+                const auto offset = glm::vec3(std::cos(phase), 0.0f, std::sin(phase)) * animation_radius;
+                scene.SetTransform(animated_instances[i],
+                    glm::translate(glm::mat4(1.0f), offset) * animated_base_transforms[i]);
+            }
+        }
+        // only the moved, added and removed instances are uploaded
+        const auto dirty_instances = scene.TakeDirtyInstances();
+        if (!dirty_instances.empty()) {
+            for (auto &pending : pending_dirty_instances) {
+                std::vector<uint32_t> merged;
+                std::set_union(pending.begin(), pending.end(), dirty_instances.begin(), dirty_instances.end(),
+                    std::back_inserter(merged));
+                pending = std::move(merged);
+            }
+        }
+        auto &renderer_dirty_instances = pending_dirty_instances[static_cast<size_t>(curr_renderer_type)];
+        if (!renderer_dirty_instances.empty()) {
+            renderer->UpdateInstances(renderer_dirty_instances);
+            renderer_dirty_instances.clear();
+        }
 
-        rasterizer.SetMatrixProj(camera.Proj());
-        rasterizer.SetMatrixView(camera.View());
+        const bool frame_changed = frame_dirty || !dirty_instances.empty() || renderer != last_renderer
+            || camera.View() != last_view || camera.Proj() != last_proj;
+        const bool render_frame = frame_changed || !skip_unchanged_frames;
+        window.SetIdle(!render_frame);
+        if (render_frame) {
+            rasterizer.ClearBuffers();
+
+            rasterizer.SetMatrixProj(camera.Proj());
+            rasterizer.SetMatrixView(camera.View());
+
+            renderer->SetContributionCullScale(contribution_cull_scale);
+            renderer->SetMaxLodError(max_lod_error);
+            renderer->SetFrontToBack(front_to_back);
+            rasterizer.SetCollectStats(collect_stats);
+            renderer->RenderScene();
+            rasterizer.EndFrame();
+            if (collect_stats) {
+                order_stats[front_to_back ? 1 : 0] = rasterizer.GetStats();
+            }
 
-        renderer->RenderScene();
+            frame_dirty = false;
+            last_view = camera.View();
+            last_proj = camera.Proj();
+            last_renderer = renderer;
+        }
 
         glUseProgram(display_program->Id());
         glBindVertexArray(empty_vao);
@@ -129,17 +216,85 @@ int main(int argc, char **argv) {
         if (ImGui::Begin("Status")) {
             float fps = ImGui::GetIO().Framerate;
             ImGui::Text("%.3f ms/frame (%.1f FPS)", 1000.0f / fps, fps);
+            if (scene.SourceInstancesCount() != scene.InstancesCount()) {
+                ImGui::Text("Instances: %zu (%zu before static batching)", scene.InstancesCount(),
+                    scene.SourceInstancesCount());
+            }
+            if (has_free_slots) {
+                ImGui::Text("Instances: %zu / %zu slots", scene.AliveInstancesCount(), scene.InstancesCount());
+                if (ImGui::Button("Add instance")) {
+                    std::vector<size_t> models;
+                    for (size_t i = 0; i < scene.ModelsCount(); i++) {
+                        if (scene.FreeSlotsCount(i) > 0) {
+                            models.push_back(i);
+                        }
+                    }
+                    if (!models.empty()) {
+                        const auto model = models[add_random() % models.size()];
+                        std::uniform_real_distribution<float> t(0.0f, 1.0f);
+                        const auto pos = glm::mix(add_bbox.pmin, add_bbox.pmax,
+                            glm::vec3(t(add_random), t(add_random), t(add_random)));
+                        added_instances.push_back(scene.AddInstance(model, glm::translate(glm::mat4(1.0f), pos)));
+                    }
+                }
+                ImGui::SameLine();
+                if (ImGui::Button("Remove instance") && !added_instances.empty()) {
+                    scene.RemoveInstance(added_instances.back());
+                    added_instances.pop_back();
+                }
+            }
 
             ImGui::Separator();
 
             auto temp_renderer = static_cast<int>(curr_renderer_type);
-            ImGui::Combo("Renderer", &temp_renderer, kRendererTypeName, 3);
+            ImGui::Combo("Renderer", &temp_renderer, kRendererTypeName, 5);
             curr_renderer_type = static_cast<RendererType>(temp_renderer);
             renderer = renderers[temp_renderer].get();
 
+            ImGui::Checkbox("Animate instances", &animate_instances);
+            ImGui::Checkbox("Skip unchanged frames", &skip_unchanged_frames);
+            ImGui::SliderFloat("Contribution culling", &contribution_cull_scale, 0.0f, 16.0f);
+            ImGui::SliderFloat("Max LOD error (px)", &max_lod_error, 0.0f, 16.0f);
+            ImGui::Checkbox("Front-to-back order", &front_to_back);
+            ImGui::Checkbox("Overdraw stats", &collect_stats);
+            if (collect_stats && ImGui::BeginTable("Overdraw", 3)) {
+                ImGui::TableSetupColumn("");
+                ImGui::TableSetupColumn("Unsorted");
+                ImGui::TableSetupColumn("Front-to-back");
+                ImGui::TableHeadersRow();
+                ImGui::TableNextRow();
+                ImGui::TableNextColumn();
+                ImGui::Text("Fragments tested");
+                for (const auto &stats : order_stats) {
+                    ImGui::TableNextColumn();
+                    ImGui::Text("%u", stats.num_fragments_tested);
+                }
+                ImGui::TableNextRow();
+                ImGui::TableNextColumn();
+                ImGui::Text("Fragments shaded");
+                for (const auto &stats : order_stats) {
+                    ImGui::TableNextColumn();
+                    ImGui::Text("%u", stats.num_fragments_shaded);
+                }
+                ImGui::TableNextRow();
+                ImGui::TableNextColumn();
+                ImGui::Text("Overdraw");
+                for (const auto &stats : order_stats) {
+                    ImGui::TableNextColumn();
+                    ImGui::Text("%.2fx", stats.num_pixels_covered == 0 ? 0.0f
+                        : static_cast<float>(stats.num_fragments_shaded) / stats.num_pixels_covered);
+                }
+                ImGui::EndTable();
+            }
+
             renderer->DrawUi();
         }
         ImGui::End();
+
+        // settings take effect in the next frame, a widget may still change its value in the frame it is released
+        const bool ui_active = ImGui::IsAnyItemActive();
+        frame_dirty |= ui_active || ui_was_active;
+        ui_was_active = ui_active;
     });
 
     glDeleteVertexArrays(1, &empty_vao);
@@ -1,5 +1,8 @@
 #include "rasterizer.hpp"
 
+#include <algorithm>
+#include <cassert>
+#include <cstddef>
 #include <fstream>
 #include <iostream>
 #include <filesystem>
@@ -14,6 +17,12 @@ constexpr uint32_t kComputeWorkGroupSize = 32;
 
 constexpr uint32_t kMaxTrianglesPerList = 1024;
 
+constexpr uint32_t kMaxTrianglesPerBatch = 8192;
+
+// the upload ring keeps one segment per frame in flight
+constexpr uint32_t kNumFramesInFlight = 3;
+constexpr uint64_t kUploadSegmentSize = 1 << 20;
+
 struct Vertex {
     glm::vec3 pos_world;
     float screen_x;
@@ -31,19 +40,43 @@ struct ListTriangle {
     float inv_area;
 };
 
+struct DrawCommand {
+    uint32_t num_indices;
+    uint32_t first_index;
+    uint32_t vertex_offset;
+    uint32_t instance_id;
+};
+
 }
 
 Rasterizer::Rasterizer(uint32_t width, uint32_t height) {
     CreateComputeProgram(rastertize_program_, kShaderSourceDir / "rasterizer/scanline.comp");
     CreateComputeProgram(clear_program_, kShaderSourceDir / "rasterizer/clear.comp");
 
-    clear_values_buffer_ = std::make_unique<GlBuffer>(sizeof(ClearValues), GL_DYNAMIC_STORAGE_BIT);
-    states_buffer_ = std::make_unique<GlBuffer>(sizeof(RasterizerStates), GL_DYNAMIC_STORAGE_BIT);
-    draw_args_buffer_ = std::make_unique<GlBuffer>(sizeof(DrawArguments), GL_DYNAMIC_STORAGE_BIT);
-    shading_buffer_ = std::make_unique<GlBuffer>(sizeof(ShadingUniforms), GL_DYNAMIC_STORAGE_BIT);
+    upload_ring_ = std::make_unique<GlRingBuffer>(kUploadSegmentSize, kNumFramesInFlight);
+    int alignment = 0;
+    glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+    uniform_alignment_ = std::max(alignment, 16);
+    glGetIntegerv(GL_SHADER_STORAGE_BUFFER_OFFSET_ALIGNMENT, &alignment);
+    storage_alignment_ = std::max(alignment, 16);
+
+    draw_args_buffer_ = std::make_unique<GlBuffer>(sizeof(DrawArguments));
 
     CreateComputeProgram(line_tile_pre_program_, kShaderSourceDir / "rasterizer/line_tile_pre.comp");
     CreateComputeProgram(line_tile_draw_program_, kShaderSourceDir / "rasterizer/line_tile_draw.comp");
+
+    CreateComputeProgram(calc_args_program_, kShaderSourceDir / "rasterizer/calc_args.comp");
+
+    uint32_t default_instance = 0;
+    default_instance_buffer_ = std::make_unique<GlBuffer>(sizeof(uint32_t), 0, &default_instance);
+
+    CreateComputeProgram(multi_draw_scan_program_, kShaderSourceDir / "rasterizer/multi_draw_scan.comp");
+    CreateComputeProgram(line_tile_multi_pre_program_, kShaderSourceDir / "rasterizer/line_tile_multi_pre.comp");
+    uint32_t default_draw_count = ~0u;
+    default_draw_count_buffer_ = std::make_unique<GlBuffer>(sizeof(uint32_t), 0, &default_draw_count);
+    multi_draw_info_buffer_ = std::make_unique<GlBuffer>(sizeof(uint32_t) * 2);
+
+    stats_buffer_ = std::make_unique<GlBuffer>(sizeof(FrameStats), GL_MAP_READ_BIT, &stats_);
 }
 
 Rasterizer::~Rasterizer() {}
@@ -71,16 +104,17 @@ void Rasterizer::SetClearColor(float r, float g, float b, float a) {
 
 void Rasterizer::SetClearDepth(float depth) {
     clear_values_.depth = depth;
+    states_.clear_depth = depth;
 }
 
 void Rasterizer::ClearBuffers() {
-    glNamedBufferSubData(clear_values_buffer_->Id(), 0, sizeof(ClearValues), &clear_values_);
+    const auto clear_values_offset = upload_ring_->Push(clear_values_, uniform_alignment_);
 
     glUseProgram(clear_program_->Id());
 
     glBindImageTexture(0, frame_buffer_->Id(), 0, GL_FALSE, 0, GL_WRITE_ONLY, frame_buffer_->Format());
     glBindImageTexture(1, depth_buffer_->Id(), 0, GL_FALSE, 0, GL_WRITE_ONLY, depth_buffer_->Format());
-    glBindBufferBase(GL_UNIFORM_BUFFER, 2, clear_values_buffer_->Id());
+    glBindBufferRange(GL_UNIFORM_BUFFER, 2, upload_ring_->Id(), clear_values_offset, sizeof(ClearValues));
 
     glDispatchCompute((states_.viewport_width + 15) / 16, (states_.viewport_height + 15) / 16, 1);
     glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
@@ -97,8 +131,7 @@ void Rasterizer::SetMatrixView(const glm::mat4 &view) {
 }
 
 void Rasterizer::SetMatrixModel(const glm::mat4 &model) {
-    states_.model = model;
-    states_.model_it = glm::transpose(glm::inverse(model));
+    states_.model = MakeInstanceTransform(model).model;
 }
 
 void Rasterizer::SetLightPosition(float x, float y, float z, float w) {
@@ -121,13 +154,21 @@ void Rasterizer::SetIndexBuffer(const GlBuffer *buffer) {
     index_buffer_ = buffer;
 }
 
+void Rasterizer::SetTransformBuffer(const GlBuffer *buffer) {
+    transform_buffer_ = buffer;
+}
+
+void Rasterizer::SetInstanceBuffer(const GlBuffer *buffer) {
+    instance_buffer_ = buffer;
+}
+
 void Rasterizer::DrawIndexed(uint32_t num_indices, uint32_t first_index, uint32_t vertex_offset) {
     draw_args_.num_indices = num_indices;
     draw_args_.first_index = first_index;
     draw_args_.vertex_offset = vertex_offset;
-    glNamedBufferSubData(states_buffer_->Id(), 0, sizeof(RasterizerStates), &states_);
-    glNamedBufferSubData(draw_args_buffer_->Id(), 0, sizeof(DrawArguments), &draw_args_);
-    glNamedBufferSubData(shading_buffer_->Id(), 0, sizeof(ShadingUniforms), &shading_);
+    draw_args_.instance_count = 1;
+    draw_args_.first_instance = 0;
+    UploadDrawUniforms();
 
 #if 0
     glUseProgram(rastertize_program_->Id());
@@ -142,65 +183,303 @@ void Rasterizer::DrawIndexed(uint32_t num_indices, uint32_t first_index, uint32_
     glBindImageTexture(3, frame_buffer_->Id(), 0, GL_FALSE, 0, GL_WRITE_ONLY, frame_buffer_->Format());
     glBindImageTexture(4, depth_buffer_->Id(), 0, GL_FALSE, 0, GL_READ_WRITE, GL_R32I);
 
-    uint32_t uniform_buffers[] = {
-        states_buffer_->Id(),
-        draw_args_buffer_->Id(),
-        shading_buffer_->Id(),
-    };
-    glBindBuffersBase(GL_UNIFORM_BUFFER, 5, 3, uniform_buffers);
+    const auto draw_args_offset = upload_ring_->Push(draw_args_, uniform_alignment_);
+    glBindBufferRange(GL_UNIFORM_BUFFER, 5, upload_ring_->Id(), states_offset_, sizeof(RasterizerStates));
+    glBindBufferRange(GL_UNIFORM_BUFFER, 6, upload_ring_->Id(), draw_args_offset, sizeof(DrawArguments));
+    glBindBufferRange(GL_UNIFORM_BUFFER, 7, upload_ring_->Id(), shading_offset_, sizeof(ShadingUniforms));
 
     glDispatchCompute((num_indices / 3 + kComputeWorkGroupSize - 1) / kComputeWorkGroupSize, 1, 1);
     glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT | GL_TEXTURE_FETCH_BARRIER_BIT);
 
     glUseProgram(0);
 #else
-    auto vertices_buffer_size = num_indices * sizeof(Vertex);
-    if (out_vertices_buffer_ == nullptr || out_vertices_buffer_->Size() < vertices_buffer_size) {
-        out_vertices_buffer_ = std::make_unique<GlBuffer>(vertices_buffer_size);
+    InstanceTransform transform { states_.model };
+    default_transform_offset_ = upload_ring_->Push(transform, storage_alignment_);
+    use_default_transform_ = true;
+    auto instance_buffer = instance_buffer_;
+    instance_buffer_ = default_instance_buffer_.get();
+    DrawLineTile(num_indices, 1, false);
+    instance_buffer_ = instance_buffer;
+    use_default_transform_ = false;
+#endif
+}
+
+void Rasterizer::DrawIndexedInstanced(uint32_t num_indices, uint32_t instance_count, uint32_t first_index,
+    uint32_t vertex_offset, uint32_t first_instance) {
+    if (instance_count == 0) {
+        return;
     }
+    draw_args_.num_indices = num_indices;
+    draw_args_.first_index = first_index;
+    draw_args_.vertex_offset = vertex_offset;
+    draw_args_.instance_count = instance_count;
+    draw_args_.first_instance = first_instance;
+    UploadDrawUniforms();
 
-    glUseProgram(line_tile_pre_program_->Id());
+    DrawLineTile(num_indices, instance_count, false);
+}
 
-    std::vector<uint32_t> storage_buffers {
-        position_buffer_->Id(),
-        normal_buffer_->Id(),
-        index_buffer_->Id(),
-        out_vertices_buffer_->Id(),
-        tile_list_num_buffer_->Id(),
-        tile_list_buffer_->Id(),
+void Rasterizer::DrawIndexedIndirect(const GlBuffer *args_buffer, uint64_t offset, uint32_t max_indices) {
+    glCopyNamedBufferSubData(args_buffer->Id(), draw_args_buffer_->Id(), offset, 0, sizeof(uint32_t) * 3);
+    uint32_t instance_args[] = { 1, 0 };
+    UploadBuffer(draw_args_buffer_.get(), offsetof(DrawArguments, instance_count), sizeof(instance_args),
+        instance_args);
+    UploadDrawUniforms();
+
+    InstanceTransform transform { states_.model };
+    default_transform_offset_ = upload_ring_->Push(transform, storage_alignment_);
+    use_default_transform_ = true;
+    auto instance_buffer = instance_buffer_;
+    instance_buffer_ = default_instance_buffer_.get();
+    DrawLineTile(max_indices, 1, true);
+    instance_buffer_ = instance_buffer;
+    use_default_transform_ = false;
+}
+
+void Rasterizer::DrawIndexedInstancedIndirect(const GlBuffer *args_buffer, uint64_t offset, uint32_t max_indices,
+    uint32_t max_instances) {
+    MultiDrawIndexedInstancedIndirect(args_buffer, offset, 1, max_indices, max_instances);
+}
+
+void Rasterizer::MultiDrawIndexedInstancedIndirect(const GlBuffer *args_buffer, uint64_t offset, uint32_t num_draws,
+    uint32_t max_indices, uint32_t max_instances) {
+    if (num_draws == 0) {
+        return;
+    }
+    const uint64_t args_size = sizeof(uint32_t) * 5 * num_draws;
+    if (draw_args_buffer_->Size() < args_size) {
+        draw_args_buffer_ = std::make_unique<GlBuffer>(args_size);
+    }
+    glCopyNamedBufferSubData(args_buffer->Id(), draw_args_buffer_->Id(), offset, 0, args_size);
+    UploadDrawUniforms();
+
+    DrawLineTile(max_indices, max_instances, true, num_draws);
+}
+
+void Rasterizer::MultiDrawIndexedIndirect(const GlBuffer *command_buffer, uint64_t offset,
+    const GlBuffer *count_buffer, uint32_t max_draws, uint32_t max_indices) {
+    assert(offset % sizeof(DrawCommand) == 0);
+    if (max_draws == 0 || max_indices < 3) {
+        return;
+    }
+    UploadDrawUniforms();
+
+    MultiDrawParams params {
+        .first_draw = static_cast<uint32_t>(offset / sizeof(DrawCommand)),
+        .max_draws = max_draws,
+        .batch_size = std::min(kMaxTrianglesPerBatch, max_indices / 3),
+        .num_batches = 0,
+        .batch_first_triangle = 0,
+        .draw_work_groups = (states_.viewport_height + kComputeWorkGroupSize - 1) / kComputeWorkGroupSize,
     };
-    glBindBuffersBase(GL_SHADER_STORAGE_BUFFER, 0, 6, storage_buffers.data());
+    params.num_batches = (max_indices / 3 + params.batch_size - 1) / params.batch_size;
+    auto params_offset = upload_ring_->Push(params, uniform_alignment_);
+
+    auto vertices_buffer_size = params.batch_size * 3 * sizeof(Vertex);
+    if (out_vertices_buffer_ == nullptr || out_vertices_buffer_->Size() < vertices_buffer_size) {
+        out_vertices_buffer_ = std::make_unique<GlBuffer>(vertices_buffer_size);
+    }
+    auto first_triangles_size = max_draws * sizeof(uint32_t);
+    if (draw_first_triangles_buffer_ == nullptr || draw_first_triangles_buffer_->Size() < first_triangles_size) {
+        draw_first_triangles_buffer_ = std::make_unique<GlBuffer>(first_triangles_size);
+    }
+    auto dispatch_args_size = params.num_batches * sizeof(BatchDispatchArguments);
+    if (batch_dispatch_args_buffer_ == nullptr || batch_dispatch_args_buffer_->Size() < dispatch_args_size) {
+        batch_dispatch_args_buffer_ = std::make_unique<GlBuffer>(dispatch_args_size);
+    }
 
-    std::vector<uint32_t> uniform_buffers {
-        states_buffer_->Id(),
-        draw_args_buffer_->Id(),
+    // the first triangle of every draw and the dispatch arguments of every batch
+    glUseProgram(multi_draw_scan_program_->Id());
+    uint32_t scan_buffers[] = {
+        command_buffer->Id(),
+        count_buffer != nullptr ? count_buffer->Id() : default_draw_count_buffer_->Id(),
+        draw_first_triangles_buffer_->Id(),
+        multi_draw_info_buffer_->Id(),
+        batch_dispatch_args_buffer_->Id(),
     };
-    glBindBuffersBase(GL_UNIFORM_BUFFER, 6, 2, uniform_buffers.data());
+    glBindBuffersBase(GL_SHADER_STORAGE_BUFFER, 0, 5, scan_buffers);
+    glBindBufferRange(GL_UNIFORM_BUFFER, 5, upload_ring_->Id(), params_offset, sizeof(MultiDrawParams));
+    glDispatchCompute(1, 1, 1);
+    glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT | GL_COMMAND_BARRIER_BIT);
+
+    for (uint32_t batch = 0; batch < params.num_batches; batch++) {
+        params.batch_first_triangle = batch * params.batch_size;
+        params_offset = upload_ring_->Push(params, uniform_alignment_);
+
+        glUseProgram(line_tile_multi_pre_program_->Id());
+
+        uint32_t storage_buffers[] = {
+            position_buffer_->Id(),
+            normal_buffer_->Id(),
+            index_buffer_->Id(),
+            out_vertices_buffer_->Id(),
+            tile_list_num_buffer_->Id(),
+            tile_list_buffer_->Id(),
+            transform_buffer_->Id(),
+        };
+        glBindBuffersBase(GL_SHADER_STORAGE_BUFFER, 0, 7, storage_buffers);
+        uint32_t draw_buffers[] = {
+            command_buffer->Id(),
+            draw_first_triangles_buffer_->Id(),
+            multi_draw_info_buffer_->Id(),
+        };
+        glBindBuffersBase(GL_SHADER_STORAGE_BUFFER, 8, 3, draw_buffers);
+
+        glBindBufferRange(GL_UNIFORM_BUFFER, 6, upload_ring_->Id(), states_offset_, sizeof(RasterizerStates));
+        glBindBufferRange(GL_UNIFORM_BUFFER, 7, upload_ring_->Id(), params_offset, sizeof(MultiDrawParams));
+
+        const uint64_t batch_offset = batch * sizeof(BatchDispatchArguments);
+        glBindBuffer(GL_DISPATCH_INDIRECT_BUFFER, batch_dispatch_args_buffer_->Id());
+        glDispatchComputeIndirect(batch_offset + offsetof(BatchDispatchArguments, pre_dispatch));
+        glBindBuffer(GL_DISPATCH_INDIRECT_BUFFER, 0);
+        glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+        DrawLineTileLists(batch_dispatch_args_buffer_.get(),
+            batch_offset + offsetof(BatchDispatchArguments, draw_dispatch));
+    }
 
-    glDispatchCompute((num_indices / 3 + kComputeWorkGroupSize - 1) / kComputeWorkGroupSize, 1, 1);
-    glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+    glUseProgram(0);
+}
+
+void Rasterizer::UploadBuffer(const GlBuffer *buffer, uint64_t offset, uint64_t size, const void *data) {
+    // a ring segment bounds a single push, larger uploads are copied piece by piece
+    const auto bytes = static_cast<const uint8_t *>(data);
+    for (uint64_t copied = 0; copied < size; copied += kUploadSegmentSize) {
+        const auto copy_size = std::min(size - copied, kUploadSegmentSize);
+        const auto src_offset = upload_ring_->Push(bytes + copied, copy_size, 16);
+        glCopyNamedBufferSubData(upload_ring_->Id(), buffer->Id(), src_offset, offset + copied, copy_size);
+    }
+}
+
+void Rasterizer::EndFrame() {
+    upload_ring_->NextSegment();
 
+    if (states_.collect_stats != 0) {
+        stats_ = *stats_buffer_->TypedMap<FrameStats>();
+        stats_buffer_->Unmap();
+        uint32_t zero = 0;
+        glClearNamedBufferData(stats_buffer_->Id(), GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, &zero);
+    }
+}
+
+void Rasterizer::UploadDrawUniforms() {
+    states_offset_ = upload_ring_->Push(states_, uniform_alignment_);
+    shading_offset_ = upload_ring_->Push(shading_, uniform_alignment_);
+}
+
+void Rasterizer::DrawLineTile(uint32_t max_indices, uint32_t max_instances, bool indirect, uint32_t num_draws) {
+    const uint32_t batch_size = std::clamp(kMaxTrianglesPerBatch * 3 / std::max(max_indices, 1u), 1u,
+        std::max(max_instances, 1u));
+    auto vertices_buffer_size = max_indices * batch_size * sizeof(Vertex);
+    if (out_vertices_buffer_ == nullptr || out_vertices_buffer_->Size() < vertices_buffer_size) {
+        out_vertices_buffer_ = std::make_unique<GlBuffer>(vertices_buffer_size);
+    }
+    // every draw but the last may end with a partial batch
+    const uint32_t num_batches = (std::max(max_instances, 1u) + batch_size - 1) / batch_size + num_draws - 1;
+
+    // the instance count of an indirect draw is only known on the GPU, so the arguments of all batches are
+    // written in one pass and the batches past it cost two empty indirect dispatches
+    const uint64_t batch_stride = (sizeof(BatchArguments) + uniform_alignment_ - 1) / uniform_alignment_
+        * uniform_alignment_;
+    if (indirect) {
+        if (batch_args_buffer_ == nullptr || batch_args_buffer_->Size() < num_batches * batch_stride) {
+            batch_args_buffer_ = std::make_unique<GlBuffer>(num_batches * batch_stride);
+        }
+        BatchParams params {
+            .batch_size = batch_size,
+            .num_batches = num_batches,
+            .batch_stride = static_cast<uint32_t>(batch_stride / sizeof(uint32_t)),
+            .draw_work_groups = (states_.viewport_height + kComputeWorkGroupSize - 1) / kComputeWorkGroupSize,
+            .num_draws = num_draws,
+        };
+        const auto params_offset = upload_ring_->Push(params, uniform_alignment_);
+
+        glUseProgram(calc_args_program_->Id());
+        uint32_t calc_args_buffers[] = {
+            draw_args_buffer_->Id(),
+            batch_args_buffer_->Id(),
+        };
+        glBindBuffersBase(GL_SHADER_STORAGE_BUFFER, 0, 2, calc_args_buffers);
+        glBindBufferRange(GL_UNIFORM_BUFFER, 2, upload_ring_->Id(), params_offset, sizeof(BatchParams));
+        glDispatchCompute(1, 1, 1);
+        glMemoryBarrier(GL_COMMAND_BARRIER_BIT | GL_UNIFORM_BARRIER_BIT);
+    }
+
+    for (uint32_t batch = 0; batch < num_batches; batch++) {
+        const uint32_t batch_first_instance = batch * batch_size;
+        const uint64_t batch_offset = batch * batch_stride;
+        uint64_t draw_args_offset = 0;
+        if (!indirect) {
+            draw_args_.batch_first_instance = batch_first_instance;
+            draw_args_.batch_size = batch_size;
+            draw_args_offset = upload_ring_->Push(draw_args_, uniform_alignment_);
+        }
+
+        glUseProgram(line_tile_pre_program_->Id());
+
+        std::vector<uint32_t> storage_buffers {
+            position_buffer_->Id(),
+            normal_buffer_->Id(),
+            index_buffer_->Id(),
+            out_vertices_buffer_->Id(),
+            tile_list_num_buffer_->Id(),
+            tile_list_buffer_->Id(),
+            use_default_transform_ ? upload_ring_->Id() : transform_buffer_->Id(),
+            instance_buffer_->Id(),
+        };
+        glBindBuffersBase(GL_SHADER_STORAGE_BUFFER, 0, 8, storage_buffers.data());
+        if (use_default_transform_) {
+            glBindBufferRange(GL_SHADER_STORAGE_BUFFER, 6, upload_ring_->Id(), default_transform_offset_,
+                sizeof(InstanceTransform));
+        }
+
+        glBindBufferRange(GL_UNIFORM_BUFFER, 6, upload_ring_->Id(), states_offset_, sizeof(RasterizerStates));
+        if (indirect) {
+            glBindBufferRange(GL_UNIFORM_BUFFER, 7, batch_args_buffer_->Id(),
+                batch_offset + offsetof(BatchArguments, draw_args), sizeof(DrawArguments));
+            glBindBuffer(GL_DISPATCH_INDIRECT_BUFFER, batch_args_buffer_->Id());
+            glDispatchComputeIndirect(batch_offset + offsetof(BatchArguments, pre_dispatch));
+            glBindBuffer(GL_DISPATCH_INDIRECT_BUFFER, 0);
+        } else {
+            glBindBufferRange(GL_UNIFORM_BUFFER, 7, upload_ring_->Id(), draw_args_offset, sizeof(DrawArguments));
+            glDispatchCompute((max_indices / 3 + kComputeWorkGroupSize - 1) / kComputeWorkGroupSize,
+                std::min(batch_size, max_instances - batch_first_instance), 1);
+        }
+        glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+        if (indirect) {
+            DrawLineTileLists(batch_args_buffer_.get(), batch_offset + offsetof(BatchArguments, draw_dispatch));
+        } else {
+            DrawLineTileLists();
+        }
+    }
+
+    glUseProgram(0);
+}
+
+void Rasterizer::DrawLineTileLists(const GlBuffer *dispatch_args, uint64_t offset) {
     glUseProgram(line_tile_draw_program_->Id());
 
-    storage_buffers = {
+    uint32_t storage_buffers[] = {
         out_vertices_buffer_->Id(),
         tile_list_num_buffer_->Id(),
         tile_list_buffer_->Id(),
     };
-    glBindBuffersBase(GL_SHADER_STORAGE_BUFFER, 0, 3, storage_buffers.data());
+    glBindBuffersBase(GL_SHADER_STORAGE_BUFFER, 0, 3, storage_buffers);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 7, stats_buffer_->Id());
 
     glBindImageTexture(3, frame_buffer_->Id(), 0, GL_FALSE, 0, GL_WRITE_ONLY, frame_buffer_->Format());
     glBindImageTexture(4, depth_buffer_->Id(), 0, GL_FALSE, 0, GL_READ_WRITE, GL_R32I);
 
-    uniform_buffers = {
-        states_buffer_->Id(),
-        shading_buffer_->Id(),
-    };
-    glBindBuffersBase(GL_UNIFORM_BUFFER, 5, 2, uniform_buffers.data());
+    glBindBufferRange(GL_UNIFORM_BUFFER, 5, upload_ring_->Id(), states_offset_, sizeof(RasterizerStates));
+    glBindBufferRange(GL_UNIFORM_BUFFER, 6, upload_ring_->Id(), shading_offset_, sizeof(ShadingUniforms));
 
-    glDispatchCompute((states_.viewport_height + kComputeWorkGroupSize - 1) / kComputeWorkGroupSize, 1, 1);
+    if (dispatch_args != nullptr) {
+        glBindBuffer(GL_DISPATCH_INDIRECT_BUFFER, dispatch_args->Id());
+        glDispatchComputeIndirect(offset);
+        glBindBuffer(GL_DISPATCH_INDIRECT_BUFFER, 0);
+    } else {
+        glDispatchCompute((states_.viewport_height + kComputeWorkGroupSize - 1) / kComputeWorkGroupSize, 1, 1);
+    }
     glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT | GL_TEXTURE_FETCH_BARRIER_BIT);
-
-    glUseProgram(0);
-#endif
 }
@@ -6,9 +6,29 @@
 
 #include "glh/program.hpp"
 #include "glh/resource.hpp"
+#include "glh/ring_buffer.hpp"
 
 class Rasterizer {
 public:
+    // per instance data of instanced draws, the first 3 rows of an affine model matrix.
+    // the normal matrix is derived from it in the shaders, see affine.glsl
+    struct InstanceTransform {
+        glm::mat3x4 model;
+    };
+    static InstanceTransform MakeInstanceTransform(const glm::mat4 &model) {
+        return InstanceTransform { .model = glm::mat3x4(glm::transpose(model)) };
+    }
+
+    // fragment counts of the draws of a frame
+    struct FrameStats {
+        // fragments that were depth tested
+        uint32_t num_fragments_tested;
+        // fragments that passed the depth test and were shaded
+        uint32_t num_fragments_shaded;
+        // pixels that got their first shaded fragment, shaded fragments over covered pixels is the overdraw
+        uint32_t num_pixels_covered;
+    };
+
     Rasterizer(uint32_t width, uint32_t height);
     ~Rasterizer();
 
@@ -35,13 +55,63 @@ public:
     void SetPositionBuffer(const GlBuffer *buffer);
     void SetNormalBuffer(const GlBuffer *buffer);
     void SetIndexBuffer(const GlBuffer *buffer);
+    // an array of InstanceTransform, used by instanced draws
+    void SetTransformBuffer(const GlBuffer *buffer);
+    // an array of indices into the transform buffer, used by instanced draws
+    void SetInstanceBuffer(const GlBuffer *buffer);
 
     void DrawIndexed(uint32_t num_indices, uint32_t first_index = 0, uint32_t vertex_offset = 0);
+    // draws `instance_count` instances of the same indices in one pass, the i-th instance uses the transform
+    // indexed by instance_buffer[first_instance + i]
+    void DrawIndexedInstanced(uint32_t num_indices, uint32_t instance_count, uint32_t first_index = 0,
+        uint32_t vertex_offset = 0, uint32_t first_instance = 0);
+    // draw arguments { num_indices, first_index, vertex_offset } are read from `args_buffer` at `offset`,
+    // `max_indices` is an upper bound of num_indices
+    void DrawIndexedIndirect(const GlBuffer *args_buffer, uint64_t offset, uint32_t max_indices);
+    // draw arguments { num_indices, first_index, vertex_offset, instance_count, first_instance } are read from
+    // `args_buffer` at `offset`, the i-th instance uses the transform indexed by instance_buffer[first_instance + i].
+    // `max_indices` and `max_instances` are upper bounds of num_indices and instance_count
+    void DrawIndexedInstancedIndirect(const GlBuffer *args_buffer, uint64_t offset, uint32_t max_indices,
+        uint32_t max_instances);
+    // draws `num_draws` consecutive draw arguments of DrawIndexedInstancedIndirect in one call, `max_indices` is an
+    // upper bound of num_indices of every draw and `max_instances` of the total instance_count of the draws
+    void MultiDrawIndexedInstancedIndirect(const GlBuffer *args_buffer, uint64_t offset, uint32_t num_draws,
+        uint32_t max_indices, uint32_t max_instances);
+    // draw commands { num_indices, first_index, vertex_offset, instance_id } are read from `command_buffer` at
+    // `offset` and the number of draws from the first uint of `count_buffer`, all `max_draws` commands are drawn
+    // if it is null. the draws share the bound position, normal and index buffers, and instance_id indexes the
+    // transform buffer directly. `max_indices` is an upper bound of the total number of indices of the draws
+    void MultiDrawIndexedIndirect(const GlBuffer *command_buffer, uint64_t offset, const GlBuffer *count_buffer,
+        uint32_t max_draws, uint32_t max_indices);
+
+    // copies `size` bytes of `data` to `buffer` at `offset` through the upload ring, ordered with the other commands
+    // like glNamedBufferSubData but without stalling on a buffer the GPU is still using
+    void UploadBuffer(const GlBuffer *buffer, uint64_t offset, uint64_t size, const void *data);
+    // called after the last draw of a frame, the upload data of a frame is kept until the GPU is done with it
+    void EndFrame();
+
+    // counting fragments waits for the GPU at the end of every frame, so it is off by default
+    void SetCollectStats(bool enable) { states_.collect_stats = enable ? 1 : 0; }
+    // stats of the last frame ended while collecting
+    const FrameStats &GetStats() const { return stats_; }
 
 private:
+    // uploads the states and shading uniforms for the next draw
+    void UploadDrawUniforms();
+
+    void DrawLineTile(uint32_t max_indices, uint32_t max_instances, bool indirect, uint32_t num_draws = 1);
+    // rasterizes the triangles binned by the last pre pass
+    // the dispatch of the draw pass is read from `dispatch_args` at `offset` if it isn't null
+    void DrawLineTileLists(const GlBuffer *dispatch_args = nullptr, uint64_t offset = 0);
+
     std::unique_ptr<GlProgram> rastertize_program_ = nullptr;
     std::unique_ptr<GlProgram> clear_program_ = nullptr;
 
+    // uniforms and staging data of the frames in flight, a draw costs a memcpy and a range binding
+    std::unique_ptr<GlRingBuffer> upload_ring_ = nullptr;
+    uint32_t uniform_alignment_ = 0;
+    uint32_t storage_alignment_ = 0;
+
     const GlTexture2D *frame_buffer_ = nullptr;
     const GlTexture2D *depth_buffer_ = nullptr;
 
@@ -49,38 +119,92 @@ private:
         glm::vec4 color = { 0.0f, 0.0f, 0.0f, 1.0f };
         float depth = 1.0f;
     } clear_values_;
-    std::unique_ptr<GlBuffer> clear_values_buffer_ = nullptr;
 
     const GlBuffer *position_buffer_ = nullptr;
     const GlBuffer *normal_buffer_ = nullptr;
     const GlBuffer *index_buffer_ = nullptr;
+    const GlBuffer *transform_buffer_ = nullptr;
+    const GlBuffer *instance_buffer_ = nullptr;
+    // non-instanced draws use a single instance with the model matrix of states_, uploaded to the ring
+    bool use_default_transform_ = false;
+    uint64_t default_transform_offset_ = 0;
+    std::unique_ptr<GlBuffer> default_instance_buffer_ = nullptr;
 
     struct alignas(16) RasterizerStates {
-        glm::mat4 model = glm::mat4(1.0f);
-        glm::mat4 model_it = glm::mat4(1.0f);
+        glm::mat3x4 model = glm::mat3x4(1.0f);
         glm::mat4 view;
         glm::mat4 proj;
         uint32_t viewport_width;
         uint32_t viewport_height;
+        uint32_t collect_stats = 0;
+        float clear_depth = 1.0f;
     } states_;
-    std::unique_ptr<GlBuffer> states_buffer_ = nullptr;
+    uint64_t states_offset_ = 0;
 
     struct alignas(16) DrawArguments {
         uint32_t num_indices;
         uint32_t first_index;
         uint32_t vertex_offset;
+        uint32_t instance_count;
+        uint32_t first_instance;
+        // instances are drawn in batches to bound the size of the vertex buffer and the per-line lists
+        uint32_t batch_first_instance;
+        uint32_t batch_size;
     } draw_args_;
+    // arguments of indirect draws are copied here on the GPU, direct draws upload draw_args_ to the ring
     std::unique_ptr<GlBuffer> draw_args_buffer_ = nullptr;
 
+    // the batches of an indirect draw get their arguments from calc_args on the GPU, so a batch without
+    // instances dispatches no work groups, see calc_args.comp
+    struct BatchArguments {
+        DrawArguments draw_args;
+        glm::uvec4 pre_dispatch;
+        glm::uvec4 draw_dispatch;
+    };
+    struct alignas(16) BatchParams {
+        uint32_t batch_size;
+        uint32_t num_batches;
+        // in uints, records are aligned for uniform buffer bindings
+        uint32_t batch_stride;
+        uint32_t draw_work_groups;
+        uint32_t num_draws;
+    };
+    std::unique_ptr<GlProgram> calc_args_program_ = nullptr;
+    std::unique_ptr<GlBuffer> batch_args_buffer_ = nullptr;
+
+    // triangles of all draws of a multi draw are numbered one after another and split into batches
+    struct alignas(16) MultiDrawParams {
+        uint32_t first_draw;
+        uint32_t max_draws;
+        uint32_t batch_size;
+        uint32_t num_batches;
+        uint32_t batch_first_triangle;
+        uint32_t draw_work_groups;
+    };
+    // the pre pass and draw pass dispatch arguments of every batch, empty batches dispatch no work groups in either
+    struct BatchDispatchArguments {
+        glm::uvec3 pre_dispatch;
+        glm::uvec3 draw_dispatch;
+    };
+    std::unique_ptr<GlProgram> multi_draw_scan_program_ = nullptr;
+    std::unique_ptr<GlProgram> line_tile_multi_pre_program_ = nullptr;
+    std::unique_ptr<GlBuffer> default_draw_count_buffer_ = nullptr;
+    std::unique_ptr<GlBuffer> draw_first_triangles_buffer_ = nullptr;
+    std::unique_ptr<GlBuffer> multi_draw_info_buffer_ = nullptr;
+    std::unique_ptr<GlBuffer> batch_dispatch_args_buffer_ = nullptr;
+
     struct alignas(16) ShadingUniforms {
         glm::vec4 light_pos_dir = { 0.0f, 1.0f, 0.0f, 0.0f };
         glm::vec4 light_emission = { 1.0f, 1.0f, 1.0f, 1.0f };
     } shading_;
-    std::unique_ptr<GlBuffer> shading_buffer_ = nullptr;
+    uint64_t shading_offset_ = 0;
 
     std::unique_ptr<GlProgram> line_tile_pre_program_ = nullptr;
     std::unique_ptr<GlProgram> line_tile_draw_program_ = nullptr;
     std::unique_ptr<GlBuffer> out_vertices_buffer_ = nullptr;
     std::unique_ptr<GlBuffer> tile_list_num_buffer_ = nullptr;
     std::unique_ptr<GlBuffer> tile_list_buffer_ = nullptr;
+
+    FrameStats stats_ {};
+    std::unique_ptr<GlBuffer> stats_buffer_ = nullptr;
 };
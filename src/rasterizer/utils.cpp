@@ -16,6 +16,26 @@ std::string ReadAll(const std::filesystem::path &path) {
     return content;
 }
 
+// resolve `#include "..."` relative to the including file, as GL_GOOGLE_include_directive does in glslang
+std::string ReadShaderSource(const std::filesystem::path &path) {
+    std::istringstream source(ReadAll(path));
+    std::string result;
+    std::string line;
+    while (std::getline(source, line)) {
+        auto pos = line.find_first_not_of(" \t");
+        if (pos != std::string::npos && line.compare(pos, 8, "#include") == 0) {
+            auto begin = line.find('"', pos);
+            auto end = line.find('"', begin + 1);
+            result += ReadShaderSource(path.parent_path() / line.substr(begin + 1, end - begin - 1));
+        } else if (pos == std::string::npos
+            || line.compare(pos, 38, "#extension GL_GOOGLE_include_directive") != 0) {
+            result += line;
+            result += '\n';
+        }
+    }
+    return result;
+}
+
 std::vector<uint8_t> ReadAllBin(const std::filesystem::path &path) {
     std::ifstream fin(path);
     fin.seekg(0, std::ios::end);
@@ -29,7 +49,7 @@ std::vector<uint8_t> ReadAllBin(const std::filesystem::path &path) {
 }
 
 void CreateComputeProgram(std::unique_ptr<GlProgram> &program, const std::filesystem::path &path) {
-    auto source = ReadAll(path);
+    auto source = ReadShaderSource(path);
     GlShader shader_module(source.c_str(), GL_COMPUTE_SHADER);
     
     program = std::make_unique<GlProgram>();
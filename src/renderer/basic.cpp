@@ -1,11 +1,106 @@
 #include "basic.hpp"
 
+#include <algorithm>
+#include <limits>
+#include <numeric>
+
+#include <glad/glad.h>
+
+BasicRenderer::BasicRenderer(Rasterizer &rasterizer, const Scene &scene) : Renderer(rasterizer, scene) {
+    std::vector<Rasterizer::InstanceTransform> transforms;
+    std::vector<uint32_t> model_slots_count(scene.ModelsCount(), 0);
+    scene.ForEachInstance([&](const Scene::Instance &inst, const Model &model) {
+        transforms.push_back(Rasterizer::MakeInstanceTransform(inst.transform));
+        ++model_slots_count[inst.model];
+    });
+    transform_buffer_ = std::make_unique<GlBuffer>(transforms.size() * sizeof(Rasterizer::InstanceTransform),
+        GL_DYNAMIC_STORAGE_BIT, transforms.data());
+
+    // every slot of a model has a place in its range, so added instances never move the ranges
+    model_first_instance_.resize(scene.ModelsCount(), 0);
+    for (size_t i = 1; i < scene.ModelsCount(); i++) {
+        model_first_instance_[i] = model_first_instance_[i - 1] + model_slots_count[i - 1];
+    }
+    model_instances_count_.resize(scene.ModelsCount(), 0);
+    instances_.resize(scene.InstancesCount(), 0);
+    BuildInstanceLists();
+    instance_buffer_ = std::make_unique<GlBuffer>(instances_.size() * sizeof(uint32_t), 0, instances_.data());
+    model_order_.resize(scene.ModelsCount());
+    std::iota(model_order_.begin(), model_order_.end(), 0);
+}
+
+void BasicRenderer::BuildInstanceLists() {
+    std::fill(model_instances_count_.begin(), model_instances_count_.end(), 0);
+    listed_instances_.assign(scene_.InstancesCount(), false);
+    for (uint32_t i = 0; i < scene_.InstancesCount(); i++) {
+        const auto &inst = scene_.GetInstance(i);
+        if (inst.alive) {
+            instances_[model_first_instance_[inst.model] + model_instances_count_[inst.model]++] = i;
+            listed_instances_[i] = true;
+        }
+    }
+}
+
+void BasicRenderer::SortFrontToBack() {
+    const auto view = rasterizer_.GetMatrixView();
+    instance_depths_.resize(scene_.InstancesCount());
+    for (uint32_t i = 0; i < scene_.InstancesCount(); i++) {
+        const auto &bbox = scene_.GetInstance(i).bbox;
+        instance_depths_[i] = -(view * glm::vec4((bbox.pmin + bbox.pmax) * 0.5f, 1.0f)).z;
+    }
+
+    sorted_instances_ = instances_;
+    std::vector<float> model_depths(scene_.ModelsCount(), std::numeric_limits<float>::max());
+    for (size_t i = 0; i < scene_.ModelsCount(); i++) {
+        const auto first = sorted_instances_.begin() + model_first_instance_[i];
+        const auto last = first + model_instances_count_[i];
+        std::sort(first, last, [&](uint32_t a, uint32_t b) { return instance_depths_[a] < instance_depths_[b]; });
+        if (first != last) {
+            model_depths[i] = instance_depths_[*first];
+        }
+    }
+    // models are drawn in the order of their nearest instance
+    std::sort(model_order_.begin(), model_order_.end(),
+        [&](uint32_t a, uint32_t b) { return model_depths[a] < model_depths[b]; });
+
+    rasterizer_.UploadBuffer(instance_buffer_.get(), 0, sorted_instances_.size() * sizeof(uint32_t),
+        sorted_instances_.data());
+    instances_sorted_ = true;
+}
+
 void BasicRenderer::RenderScene() {
-    scene_.ForEachInstance([this](const Scene::Instance &inst, const Model &model) {
-        rasterizer_.SetMatrixModel(inst.transform);
-        rasterizer_.SetPositionBuffer(model.PositionBuffer());
-        rasterizer_.SetNormalBuffer(model.NormalBuffer());
-        rasterizer_.SetIndexBuffer(model.IndexBuffer());
-        rasterizer_.DrawIndexed(model.IndicesCount());
+    if (front_to_back_) {
+        SortFrontToBack();
+    } else if (instances_sorted_) {
+        rasterizer_.UploadBuffer(instance_buffer_.get(), 0, instances_.size() * sizeof(uint32_t), instances_.data());
+        std::iota(model_order_.begin(), model_order_.end(), 0);
+        instances_sorted_ = false;
+    }
+
+    rasterizer_.SetTransformBuffer(transform_buffer_.get());
+    rasterizer_.SetInstanceBuffer(instance_buffer_.get());
+    const auto &geometry = scene_.GetGeometryPool();
+    rasterizer_.SetPositionBuffer(geometry.PositionBuffer());
+    rasterizer_.SetNormalBuffer(geometry.NormalBuffer());
+    rasterizer_.SetIndexBuffer(geometry.IndexBuffer());
+    for (auto i : model_order_) {
+        const auto &model = scene_.GetModel(i);
+        rasterizer_.DrawIndexedInstanced(model.IndicesCount(), model_instances_count_[i], model.FirstIndex(),
+            model.VertexOffset(), model_first_instance_[i]);
+    }
+}
+
+void BasicRenderer::UpdateInstances(const std::vector<uint32_t> &instances) {
+    UploadInstanceRuns<Rasterizer::InstanceTransform>(transform_buffer_.get(), instances, [this](uint32_t inst_id) {
+        return Rasterizer::MakeInstanceTransform(scene_.GetInstance(inst_id).transform);
+    });
+
+    // added and removed instances change the instance lists, a front-to-back frame sorts them again anyway
+    const bool lists_changed = std::any_of(instances.begin(), instances.end(), [this](uint32_t inst_id) {
+        return scene_.GetInstance(inst_id).alive != listed_instances_[inst_id];
     });
+    if (lists_changed) {
+        BuildInstanceLists();
+        rasterizer_.UploadBuffer(instance_buffer_.get(), 0, instances_.size() * sizeof(uint32_t), instances_.data());
+    }
 }
@@ -4,7 +4,29 @@
 
 class BasicRenderer final : public Renderer {
 public:
-    BasicRenderer(Rasterizer &rasterizer, const Scene &scene) : Renderer(rasterizer, scene) {}
+    BasicRenderer(Rasterizer &rasterizer, const Scene &scene);
 
     void RenderScene() override;
+
+    void UpdateInstances(const std::vector<uint32_t> &instances) override;
+
+private:
+    // lists the alive instances at the front of the range of their model
+    void BuildInstanceLists();
+    // sorts the instances of every model and the models by view depth, and uploads the sorted instances
+    void SortFrontToBack();
+
+    std::unique_ptr<GlBuffer> transform_buffer_ = nullptr;
+    // instances sorted by model, all instances of a model are drawn in one instanced draw
+    std::unique_ptr<GlBuffer> instance_buffer_ = nullptr;
+    std::vector<uint32_t> instances_;
+    std::vector<uint32_t> model_first_instance_;
+    std::vector<uint32_t> model_instances_count_;
+    std::vector<bool> listed_instances_;
+    std::vector<uint32_t> model_order_;
+
+    // front-to-back order is re-sorted every frame on the CPU
+    bool instances_sorted_ = false;
+    std::vector<uint32_t> sorted_instances_;
+    std::vector<float> instance_depths_;
 };
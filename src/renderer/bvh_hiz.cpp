@@ -0,0 +1,238 @@
+#include "bvh_hiz.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <limits>
+#include <stack>
+
+#include <imgui.h>
+
+namespace {
+
+constexpr uint32_t kBvhMaxLeafSize = 4;
+constexpr uint32_t kSahBins = 16;
+// cost of testing a node relative to drawing an instance
+constexpr float kSahTraversalCost = 0.5f;
+
+float SurfaceArea(const Bbox &bbox) {
+    auto d = glm::max(bbox.pmax - bbox.pmin, glm::vec3(0.0f));
+    return 2.0f * (d.x * d.y + d.y * d.z + d.z * d.x);
+}
+
+}
+
+BvhHiZRenderer::BvhHiZRenderer(Rasterizer &rasterizer, const Scene &scene) : Renderer(rasterizer, scene) {
+    culler_ = std::make_unique<HierarchyCuller>(scene);
+    ConstructBvh();
+
+    hiz_buffer_ = std::make_unique<HiZBuffer>();
+    occluder_prepass_ = std::make_unique<OccluderPrepass>(scene);
+}
+
+void BvhHiZRenderer::RenderScene() {
+    auto depth_buffer = rasterizer_.GetDepthTarget();
+    bool has_prev_depth = true;
+    if (hiz_buffer_->Width() != depth_buffer->Width() || hiz_buffer_->Height() != depth_buffer->Height()) {
+        hiz_buffer_->Resize(depth_buffer->Width(), depth_buffer->Height());
+        has_prev_depth = false;
+    }
+    // without depth of the previous frame, the Hi-Z buffer is built from the occluders of this frame
+    if (!has_prev_depth || occluder_prepass_->EveryFrame()) {
+        occluder_prepass_->Render(rasterizer_, *hiz_buffer_);
+    }
+
+    culler_->Cull(*hiz_buffer_, rasterizer_.GetMatrixProj() * rasterizer_.GetMatrixView(), contribution_cull_scale_,
+        LodPixelScale(), max_lod_error_, front_to_back_);
+    culler_->Draw(rasterizer_);
+    num_drawn_instances_ = culler_->NumDrawnInstances();
+
+    hiz_buffer_->Generate(depth_buffer);
+}
+
+void BvhHiZRenderer::DrawUi() {
+    if (culler_->PollStats()) {
+        num_drawn_instances_ = culler_->NumDrawnInstances();
+    }
+    ImGui::Text("Culling: %d / %d", num_drawn_instances_, static_cast<uint32_t>(scene_.AliveInstancesCount()));
+    culler_->DrawUi();
+    occluder_prepass_->DrawUi();
+}
+
+void BvhHiZRenderer::UpdateInstances(const std::vector<uint32_t> &instances) {
+    if (!culler_->UpdateInstances(instances)) {
+        ConstructBvh();
+    }
+}
+
+void BvhHiZRenderer::ConstructBvh() {
+    const auto start_time = std::chrono::steady_clock::now();
+
+    // free slots of the scene are left out until instances are added to them
+    std::vector<glm::vec3> centroids(scene_.InstancesCount());
+    bvh_instances_.clear();
+    for (uint32_t i = 0; i < scene_.InstancesCount(); i++) {
+        centroids[i] = scene_.GetInstance(i).bbox.Centroid();
+        if (scene_.GetInstance(i).alive) {
+            bvh_instances_.push_back(i);
+        }
+    }
+    const uint32_t num_instances = bvh_instances_.size();
+
+    bvh_nodes_.clear();
+    bvh_nodes_.push_back(BvhNode { scene_.Bbox(), 0, num_instances, { -1, -1 }, 0 });
+    bvh_max_level_ = 0;
+
+    // binned SAH, the instances of a node are partitioned in place so that the children get adjacent ranges
+    std::stack<uint32_t> stack;
+    stack.push(0);
+    while (!stack.empty()) {
+        auto u = stack.top();
+        stack.pop();
+
+        const auto begin = bvh_instances_.begin() + bvh_nodes_[u].first_instance;
+        const auto end = begin + bvh_nodes_[u].num_instances;
+        auto &bbox = bvh_nodes_[u].bbox;
+        Bbox centroid_bbox {};
+        bbox.Empty();
+        centroid_bbox.Empty();
+        for (auto it = begin; it != end; it++) {
+            bbox.Merge(scene_.GetInstance(*it).bbox);
+            centroid_bbox.Merge(centroids[*it]);
+        }
+
+        const uint32_t num = bvh_nodes_[u].num_instances;
+        if (num <= 1) {
+            continue;
+        }
+
+        const auto centroid_extent = centroid_bbox.pmax - centroid_bbox.pmin;
+        const int axis = centroid_extent.x >= centroid_extent.y
+            ? (centroid_extent.x >= centroid_extent.z ? 0 : 2)
+            : (centroid_extent.y >= centroid_extent.z ? 1 : 2);
+
+        auto mid = begin + num / 2;
+        if (centroid_extent[axis] <= 0.0f) {
+            // all centroids coincide, only split if the leaf would be too large
+            if (num <= kBvhMaxLeafSize) {
+                continue;
+            }
+        } else {
+            const float bin_scale = kSahBins / centroid_extent[axis];
+            auto bin_of = [&](uint32_t inst_id) {
+                auto bin = static_cast<uint32_t>((centroids[inst_id][axis] - centroid_bbox.pmin[axis]) * bin_scale);
+                return std::min(bin, kSahBins - 1);
+            };
+
+            Bbox bin_bboxes[kSahBins];
+            uint32_t bin_counts[kSahBins] = {};
+            for (auto &bin_bbox : bin_bboxes) {
+                bin_bbox.Empty();
+            }
+            for (auto it = begin; it != end; it++) {
+                auto bin = bin_of(*it);
+                bin_bboxes[bin].Merge(scene_.GetInstance(*it).bbox);
+                ++bin_counts[bin];
+            }
+
+            // sweep from the right to get the cost of the right side of every split plane
+            float right_costs[kSahBins];
+            Bbox right_bbox {};
+            right_bbox.Empty();
+            uint32_t right_count = 0;
+            for (uint32_t i = kSahBins - 1; i > 0; i--) {
+                right_bbox.Merge(bin_bboxes[i]);
+                right_count += bin_counts[i];
+                right_costs[i] = right_count == 0 ? 0.0f : SurfaceArea(right_bbox) * right_count;
+            }
+            Bbox left_bbox {};
+            left_bbox.Empty();
+            uint32_t left_count = 0;
+            float best_cost = std::numeric_limits<float>::max();
+            uint32_t best_split = 0;
+            for (uint32_t i = 1; i < kSahBins; i++) {
+                left_bbox.Merge(bin_bboxes[i - 1]);
+                left_count += bin_counts[i - 1];
+                if (left_count == 0 || left_count == num) {
+                    continue;
+                }
+                float cost = SurfaceArea(left_bbox) * left_count + right_costs[i];
+                if (cost < best_cost) {
+                    best_cost = cost;
+                    best_split = i;
+                }
+            }
+
+            const float leaf_cost = SurfaceArea(bbox) * num;
+            const float split_cost = SurfaceArea(bbox) * kSahTraversalCost + best_cost;
+            if (num <= kBvhMaxLeafSize && leaf_cost <= split_cost) {
+                continue;
+            }
+            mid = std::partition(begin, end, [&](uint32_t inst_id) { return bin_of(inst_id) < best_split; });
+        }
+
+        const uint32_t level = bvh_nodes_[u].level + 1;
+        const uint32_t first = bvh_nodes_[u].first_instance;
+        const uint32_t num_left = mid - begin;
+        uint32_t c_id = bvh_nodes_.size();
+        bvh_nodes_[u].ch[0] = c_id;
+        bvh_nodes_[u].ch[1] = c_id + 1;
+        bvh_nodes_.push_back(BvhNode { {}, first, num_left, { -1, -1 }, level });
+        bvh_nodes_.push_back(BvhNode { {}, first + num_left, num - num_left, { -1, -1 }, level });
+        bvh_max_level_ = std::max(bvh_max_level_, level);
+        stack.push(c_id + 1);
+        stack.push(c_id);
+    }
+
+    // collapse into an 8-wide BVH to fill the children of the culler nodes,
+    // a node keeps opening its largest internal child until it has 8 children
+    std::vector<HierarchyCuller::Node> gpu_bvh;
+    std::vector<uint32_t> sources;
+    std::vector<uint32_t> wide_levels;
+    auto push_node = [&](uint32_t u, uint32_t level) {
+        const auto &node = bvh_nodes_[u];
+        HierarchyCuller::Node gpu_node {
+            .ch = { -1, -1, -1, -1, -1, -1, -1, -1 },
+            .bbox = node.bbox,
+            .first_instance = node.first_instance,
+            .num_instances = node.num_instances,
+        };
+        gpu_bvh.push_back(gpu_node);
+        sources.push_back(u);
+        wide_levels.push_back(level);
+    };
+    push_node(0, 0);
+    for (size_t i = 0; i < gpu_bvh.size(); i++) {
+        const auto &node = bvh_nodes_[sources[i]];
+        if (node.IsLeaf()) {
+            continue;
+        }
+        std::vector<uint32_t> children { static_cast<uint32_t>(node.ch[0]), static_cast<uint32_t>(node.ch[1]) };
+        while (children.size() < 8) {
+            auto largest = children.end();
+            float largest_area = -1.0f;
+            for (auto it = children.begin(); it != children.end(); it++) {
+                if (!bvh_nodes_[*it].IsLeaf() && SurfaceArea(bvh_nodes_[*it].bbox) > largest_area) {
+                    largest = it;
+                    largest_area = SurfaceArea(bvh_nodes_[*it].bbox);
+                }
+            }
+            if (largest == children.end()) {
+                break;
+            }
+            const auto opened = *largest;
+            *largest = bvh_nodes_[opened].ch[0];
+            children.push_back(bvh_nodes_[opened].ch[1]);
+        }
+        for (size_t k = 0; k < children.size(); k++) {
+            gpu_bvh[i].ch[k] = gpu_bvh.size();
+            push_node(children[k], wide_levels[i] + 1);
+        }
+    }
+    culler_->SetHierarchy(gpu_bvh, bvh_instances_);
+
+    const std::chrono::duration<double, std::milli> build_time = std::chrono::steady_clock::now() - start_time;
+    std::cout << "BVH: " << bvh_nodes_.size() << " nodes, " << bvh_max_level_ + 1 << " levels, collapsed to "
+        << gpu_bvh.size() << " nodes, " << *std::max_element(wide_levels.begin(), wide_levels.end()) + 1
+        << " levels, built in " << build_time.count() << " ms\n";
+}
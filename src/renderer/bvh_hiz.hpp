@@ -0,0 +1,43 @@
+#pragma once
+
+#include "renderer.hpp"
+#include "hiz.hpp"
+#include "occluder_prepass.hpp"
+#include "hierarchy_cull.hpp"
+
+class BvhHiZRenderer final : public Renderer {
+public:
+    BvhHiZRenderer(Rasterizer &rasterizer, const Scene &scene);
+
+    void RenderScene() override;
+
+    void DrawUi() override;
+
+    void UpdateInstances(const std::vector<uint32_t> &instances) override;
+
+private:
+    void ConstructBvh();
+
+    std::unique_ptr<HiZBuffer> hiz_buffer_ = nullptr;
+    std::unique_ptr<OccluderPrepass> occluder_prepass_ = nullptr;
+
+    std::unique_ptr<HierarchyCuller> culler_ = nullptr;
+
+    // instances of a node are the range [first_instance, first_instance + num_instances) of `bvh_instances_`,
+    // a leaf has no children
+    struct BvhNode {
+        Bbox bbox;
+        uint32_t first_instance;
+        uint32_t num_instances;
+        int ch[2];
+        uint32_t level;
+
+        bool IsLeaf() const { return ch[0] == -1; }
+    };
+    std::vector<BvhNode> bvh_nodes_;
+    std::vector<uint32_t> bvh_instances_;
+
+    uint32_t bvh_max_level_ = 0;
+
+    uint32_t num_drawn_instances_ = 0;
+};
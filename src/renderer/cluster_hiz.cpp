@@ -0,0 +1,237 @@
+#include "cluster_hiz.hpp"
+
+#include <glad/glad.h>
+#include <imgui.h>
+
+#include "rasterizer/utils.hpp"
+
+namespace {
+
+struct alignas(16) CameraInfo {
+    glm::mat4 view_proj;
+    glm::vec4 eye_pos;
+    float min_pixel_area_scale;
+    uint32_t num_work_items;
+};
+
+struct alignas(16) ClusterInstance {
+    glm::mat4 transform;
+    glm::mat4 inv_transform;
+    uint32_t first_meshlet;
+    uint32_t num_meshlets;
+    uint32_t first_src_index;
+    uint32_t first_dst_index;
+    // bounds of the model for contribution culling
+    glm::vec3 bbox_min;
+    float min_pixel_area;
+    glm::vec3 bbox_max;
+};
+
+struct CullResults {
+    uint32_t num_visible;
+    uint32_t num_contribution_culled;
+};
+
+// frames of cull results that may be in flight before the results of a frame are dropped
+constexpr uint32_t kCullResultReadbackCopies = 3;
+
+struct DrawCommand {
+    uint32_t num_indices;
+    uint32_t first_index;
+    uint32_t vertex_offset;
+    uint32_t instance_id;
+};
+
+// free instance slots of the scene have no meshlets, so they never emit indices
+ClusterInstance MakeClusterInstance(const Scene &scene, uint32_t inst_id, uint32_t first_meshlet,
+    uint32_t first_dst_index) {
+    const auto &inst = scene.GetInstance(inst_id);
+    const auto &model = scene.GetModel(inst.model);
+    return ClusterInstance {
+        .transform = inst.transform,
+        .inv_transform = glm::inverse(inst.transform),
+        .first_meshlet = first_meshlet,
+        .num_meshlets = inst.alive ? static_cast<uint32_t>(model.MeshletsCount()) : 0,
+        // meshlets only cover lod 0, the cluster culling works on the full models
+        .first_src_index = model.FirstIndex(),
+        .first_dst_index = first_dst_index,
+        .bbox_min = model.Bbox().pmin,
+        .min_pixel_area = scene.ModelMinPixelArea(inst.model),
+        .bbox_max = model.Bbox().pmax,
+    };
+}
+
+}
+
+ClusterHiZRenderer::ClusterHiZRenderer(Rasterizer &rasterizer, const Scene &scene) : Renderer(rasterizer, scene) {
+    CreateComputeProgram(cluster_cull_program_, kShaderSourceDir / "cluster_hiz/cull.comp");
+
+    // meshlets of all models are packed into one buffer, their indices are read from the geometry pool
+    std::vector<Model::Meshlet> meshlets;
+    for (size_t i = 0; i < scene.ModelsCount(); i++) {
+        const auto &model = scene.GetModel(i);
+        model_first_meshlet_.push_back(meshlets.size());
+        meshlets.insert(meshlets.end(), model.Meshlets().begin(), model.Meshlets().end());
+    }
+
+    // each instance writes its surviving indices into its own range of the culled index buffer
+    std::vector<ClusterInstance> cluster_instances;
+    std::vector<Rasterizer::InstanceTransform> transforms;
+    std::vector<DrawCommand> draw_commands;
+    uint32_t num_dst_indices = 0;
+    size_t max_work_items = 0;
+    scene.ForEachInstance([&](const Scene::Instance &inst, const Model &model) {
+        const auto inst_id = static_cast<uint32_t>(cluster_instances.size());
+        instance_first_dst_index_.push_back(num_dst_indices);
+        cluster_instances.push_back(MakeClusterInstance(scene, inst_id, model_first_meshlet_[inst.model],
+            num_dst_indices));
+        transforms.push_back(Rasterizer::MakeInstanceTransform(inst.transform));
+        draw_commands.push_back(DrawCommand {
+            .num_indices = 0,
+            .first_index = num_dst_indices,
+            .vertex_offset = model.VertexOffset(),
+            .instance_id = static_cast<uint32_t>(transforms.size() - 1),
+        });
+        num_dst_indices += model.IndicesCount();
+        instance_alive_.push_back(inst.alive);
+        max_work_items += model.MeshletsCount();
+    });
+
+    meshlet_buffer_ = std::make_unique<GlBuffer>(meshlets.size() * sizeof(Model::Meshlet), 0, meshlets.data());
+    cluster_instance_buffer_ = std::make_unique<GlBuffer>(cluster_instances.size() * sizeof(ClusterInstance),
+        GL_DYNAMIC_STORAGE_BIT, cluster_instances.data());
+    transform_buffer_ = std::make_unique<GlBuffer>(transforms.size() * sizeof(Rasterizer::InstanceTransform),
+        GL_DYNAMIC_STORAGE_BIT, transforms.data());
+    init_draw_command_buffer_ = std::make_unique<GlBuffer>(draw_commands.size() * sizeof(DrawCommand), 0,
+        draw_commands.data());
+    draw_command_buffer_ = std::make_unique<GlBuffer>(draw_commands.size() * sizeof(DrawCommand));
+    culled_index_buffer_ = std::make_unique<GlBuffer>(num_dst_indices * sizeof(uint32_t));
+    cull_result_buffer_ = std::make_unique<GlBuffer>(sizeof(CullResults));
+    cull_result_readback_ = std::make_unique<GlReadbackBuffer>(sizeof(CullResults), kCullResultReadbackCopies);
+
+    camera_info_buffer_ = std::make_unique<GlBuffer>(sizeof(CameraInfo));
+
+    // sized for every slot being alive, so that added instances never grow it
+    work_item_buffer_ = std::make_unique<GlBuffer>(std::max(max_work_items, size_t(1)) * sizeof(glm::uvec2),
+        GL_DYNAMIC_STORAGE_BIT);
+    UploadWorkItems();
+    // only 65535 work groups per dimension are guaranteed, the work groups loop over the pairs beyond that
+    int max_work_groups = 0;
+    glGetIntegeri_v(GL_MAX_COMPUTE_WORK_GROUP_COUNT, 0, &max_work_groups);
+    max_work_groups_ = static_cast<uint32_t>(std::max(max_work_groups, 1));
+
+    hiz_buffer_ = std::make_unique<HiZBuffer>();
+    occluder_prepass_ = std::make_unique<OccluderPrepass>(scene);
+}
+
+void ClusterHiZRenderer::RenderScene() {
+    auto depth_buffer = rasterizer_.GetDepthTarget();
+    bool has_prev_depth = true;
+    if (hiz_buffer_->Width() != depth_buffer->Width() || hiz_buffer_->Height() != depth_buffer->Height()) {
+        hiz_buffer_->Resize(depth_buffer->Width(), depth_buffer->Height());
+        has_prev_depth = false;
+    }
+    // without depth of the previous frame, the Hi-Z buffer is built from the occluders of this frame
+    if (!has_prev_depth || occluder_prepass_->EveryFrame()) {
+        occluder_prepass_->Render(rasterizer_, *hiz_buffer_);
+    }
+
+    const auto view = rasterizer_.GetMatrixView();
+    CameraInfo camera {
+        .view_proj = rasterizer_.GetMatrixProj() * view,
+        .eye_pos = glm::inverse(view)[3],
+        .min_pixel_area_scale = contribution_cull_scale_,
+        .num_work_items = num_work_items_,
+    };
+    rasterizer_.UploadBuffer(camera_info_buffer_.get(), 0, sizeof(CameraInfo), &camera);
+
+    glCopyNamedBufferSubData(init_draw_command_buffer_->Id(), draw_command_buffer_->Id(), 0, 0,
+        draw_command_buffer_->Size());
+    CullResults cull_res {};
+    rasterizer_.UploadBuffer(cull_result_buffer_.get(), 0, sizeof(CullResults), &cull_res);
+
+    glUseProgram(cluster_cull_program_->Id());
+    hiz_buffer_->Bind(0, 1);
+    glBindBufferBase(GL_UNIFORM_BUFFER, 2, camera_info_buffer_->Id());
+    uint32_t cull_buffers[] = {
+        meshlet_buffer_->Id(),
+        cluster_instance_buffer_->Id(),
+        scene_.GetGeometryPool().IndexBuffer()->Id(),
+        culled_index_buffer_->Id(),
+        draw_command_buffer_->Id(),
+        cull_result_buffer_->Id(),
+    };
+    glBindBuffersBase(GL_SHADER_STORAGE_BUFFER, 3, 6, cull_buffers);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 9, work_item_buffer_->Id());
+    if (num_work_items_ > 0) {
+        glDispatchCompute(std::min(num_work_items_, max_work_groups_), 1, 1);
+    }
+    glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT | GL_BUFFER_UPDATE_BARRIER_BIT);
+    glUseProgram(0);
+
+    rasterizer_.SetTransformBuffer(transform_buffer_.get());
+    rasterizer_.SetPositionBuffer(scene_.GetGeometryPool().PositionBuffer());
+    rasterizer_.SetNormalBuffer(scene_.GetGeometryPool().NormalBuffer());
+    rasterizer_.SetIndexBuffer(culled_index_buffer_.get());
+    rasterizer_.MultiDrawIndexedIndirect(draw_command_buffer_.get(), 0, nullptr, scene_.InstancesCount(),
+        culled_index_buffer_->Size() / sizeof(uint32_t));
+
+    cull_result_readback_->Copy(cull_result_buffer_->Id(), 0, 0, sizeof(CullResults));
+    cull_result_readback_->Submit();
+    PollCullResults();
+
+    hiz_buffer_->Generate(depth_buffer);
+}
+
+void ClusterHiZRenderer::PollCullResults() {
+    if (cull_result_readback_->Poll()) {
+        const auto cull_res = cull_result_readback_->TypedData<CullResults>();
+        num_drawn_clusters_ = cull_res->num_visible;
+        num_contribution_culled_ = cull_res->num_contribution_culled;
+    }
+}
+
+void ClusterHiZRenderer::UploadWorkItems() {
+    // the pairs of an instance follow the ones of the previous alive instance
+    std::vector<glm::uvec2> work_items;
+    uint32_t inst_id = 0;
+    scene_.ForEachInstance([&](const Scene::Instance &inst, const Model &model) {
+        if (inst.alive) {
+            for (uint32_t i = 0; i < model.MeshletsCount(); i++) {
+                work_items.emplace_back(inst_id, i);
+            }
+        }
+        ++inst_id;
+    });
+    num_work_items_ = static_cast<uint32_t>(work_items.size());
+    num_total_clusters_ = num_work_items_;
+    rasterizer_.UploadBuffer(work_item_buffer_.get(), 0, work_items.size() * sizeof(glm::uvec2), work_items.data());
+}
+
+void ClusterHiZRenderer::DrawUi() {
+    PollCullResults();
+    ImGui::Text("Culling: %d / %d clusters", num_drawn_clusters_, num_total_clusters_);
+    ImGui::Text("Contribution culled: %d", num_contribution_culled_);
+    occluder_prepass_->DrawUi();
+}
+
+void ClusterHiZRenderer::UpdateInstances(const std::vector<uint32_t> &instances) {
+    UploadInstanceRuns<ClusterInstance>(cluster_instance_buffer_.get(), instances, [this](uint32_t inst_id) {
+        const auto model = scene_.GetInstance(inst_id).model;
+        return MakeClusterInstance(scene_, inst_id, model_first_meshlet_[model], instance_first_dst_index_[inst_id]);
+    });
+    UploadInstanceRuns<Rasterizer::InstanceTransform>(transform_buffer_.get(), instances, [this](uint32_t inst_id) {
+        return Rasterizer::MakeInstanceTransform(scene_.GetInstance(inst_id).transform);
+    });
+
+    // the work list only changes when instances are added or removed
+    bool alive_changed = false;
+    for (auto inst_id : instances) {
+        const bool alive = scene_.GetInstance(inst_id).alive;
+        alive_changed |= instance_alive_[inst_id] != alive;
+        instance_alive_[inst_id] = alive;
+    }
+    if (alive_changed) {
+        UploadWorkItems();
+    }
+}
@@ -0,0 +1,51 @@
+#pragma once
+
+#include "renderer.hpp"
+#include "hiz.hpp"
+#include "occluder_prepass.hpp"
+#include "glh/readback_buffer.hpp"
+
+// Culls the meshlets of every instance against the frustum, their normal cones and the Hi-Z buffer,
+// and only sends the surviving meshlets to the rasterizer.
+class ClusterHiZRenderer final : public Renderer {
+public:
+    ClusterHiZRenderer(Rasterizer &rasterizer, const Scene &scene);
+
+    void RenderScene() override;
+
+    void DrawUi() override;
+
+    void UpdateInstances(const std::vector<uint32_t> &instances) override;
+
+private:
+    // collects the cull results the GPU is done with, they arrive one or two frames late
+    void PollCullResults();
+    // lists the (instance, meshlet) pairs of the alive instances, the cull pass runs one work group per pair
+    void UploadWorkItems();
+
+    std::unique_ptr<GlProgram> cluster_cull_program_ = nullptr;
+
+    std::unique_ptr<HiZBuffer> hiz_buffer_ = nullptr;
+    std::unique_ptr<OccluderPrepass> occluder_prepass_ = nullptr;
+
+    std::unique_ptr<GlBuffer> meshlet_buffer_ = nullptr;
+    std::unique_ptr<GlBuffer> cluster_instance_buffer_ = nullptr;
+    std::unique_ptr<GlBuffer> transform_buffer_ = nullptr;
+    // one draw command per instance, all instances are drawn by one multi draw
+    std::unique_ptr<GlBuffer> init_draw_command_buffer_ = nullptr;
+    std::unique_ptr<GlBuffer> draw_command_buffer_ = nullptr;
+    std::unique_ptr<GlBuffer> culled_index_buffer_ = nullptr;
+    std::unique_ptr<GlBuffer> cull_result_buffer_ = nullptr;
+    std::unique_ptr<GlReadbackBuffer> cull_result_readback_ = nullptr;
+    std::unique_ptr<GlBuffer> camera_info_buffer_ = nullptr;
+    std::unique_ptr<GlBuffer> work_item_buffer_ = nullptr;
+
+    std::vector<uint32_t> model_first_meshlet_;
+    std::vector<uint32_t> instance_first_dst_index_;
+    std::vector<bool> instance_alive_;
+    uint32_t num_work_items_ = 0;
+    uint32_t max_work_groups_ = 0;
+    uint32_t num_total_clusters_ = 0;
+    uint32_t num_drawn_clusters_ = 0;
+    uint32_t num_contribution_culled_ = 0;
+};
@@ -0,0 +1,950 @@
+#include "hierarchy_cull.hpp"
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <limits>
+
+#include <glad/glad.h>
+#include <imgui.h>
+
+#include "rasterizer/utils.hpp"
+#include "lod.hpp"
+#include "hlod.hpp"
+
+namespace {
+
+struct alignas(16) CameraInfo {
+    glm::mat4 view_proj;
+    glm::vec2 screen_size;
+    float min_pixel_area_scale;
+    float lod_pixel_scale;
+    float max_lod_error;
+    float hlod_max_pixels;
+    uint32_t sort_draws;
+};
+
+struct CullStats {
+    uint32_t num_tested_nodes;
+    uint32_t num_contribution_culled;
+    uint32_t num_drawn_proxies;
+};
+
+struct DrawArguments {
+    uint32_t num_indices;
+    uint32_t first_index;
+    uint32_t vertex_offset;
+    uint32_t instance_count;
+    uint32_t first_instance;
+};
+
+struct ProxyDrawArguments {
+    uint32_t num_indices;
+    uint32_t first_index;
+    uint32_t vertex_offset;
+};
+
+constexpr uint32_t kEmptySlot = ~0u;
+// leaf of a free instance slot of the scene
+constexpr uint32_t kNoLeaf = ~0u;
+constexpr uint32_t kLeafBit = 0x80000000u;
+constexpr uint32_t kLeafFreeSlots = 2;
+// an instance stays in its leaf while it is inside the leaf bounds enlarged by this fraction on each side
+constexpr float kLooseBoundsScale = 0.5f;
+
+// frames of stats that may be in flight before the stats of a frame are dropped
+constexpr uint32_t kStatsReadbackCopies = 3;
+
+constexpr uint32_t kComputeWorkGroupSize = 64;
+// work groups of the persistent traversal when the number of multiprocessors can't be queried
+constexpr uint32_t kPersistentWorkGroups = 64;
+
+// cells along the longest side of a node when its proxy is baked, about a pixel per cell at the default threshold
+constexpr uint32_t kHlodGridResolution = 16;
+
+struct alignas(16) InstanceUpdate {
+    glm::mat3x4 model;
+    Bbox bbox;
+    uint32_t instance;
+};
+
+struct alignas(16) UpdateParams {
+    uint32_t num_instances;
+    uint32_t num_slots;
+};
+
+struct alignas(16) RefitParams {
+    uint32_t first_node;
+    uint32_t num_nodes;
+    uint32_t num_internal_nodes;
+};
+
+// power of two scales of the quantized child bounds are stored biased in one byte
+constexpr int kExponentBias = 127;
+constexpr int kMinExponent = -126;
+constexpr int kMaxExponent = 127;
+
+// the quantized children of an internal node, everything a node test reads sits in one 64 byte line
+struct alignas(16) GpuNode {
+    glm::vec3 origin;
+    // biased exponents of the x, y and z scales in the low 3 bytes, child mask in the high byte
+    uint32_t exps_mask;
+    // byte `axis * 8 + child`, empty children have min > max
+    uint32_t child_min[6];
+    uint32_t child_max[6];
+};
+static_assert(sizeof(GpuNode) == 64);
+
+// children of the same kind are consecutive, so the first one of each kind is enough
+struct GpuNodeLinks {
+    uint32_t first_internal;
+    // first leaf child in the low 24 bits, leaf mask in the high byte
+    uint32_t first_leaf_mask;
+    uint32_t first_instance;
+    uint32_t num_instances;
+};
+
+struct GpuLeaf {
+    uint32_t first_instance;
+    uint32_t num_instances;
+};
+
+// range of the proxy mesh indices, empty if the node has no proxy
+struct GpuProxy {
+    uint32_t first_index;
+    uint32_t num_indices;
+};
+
+void SetChildByte(uint32_t *bytes, uint32_t axis, uint32_t child, uint32_t value) {
+    const uint32_t i = axis * 8 + child;
+    bytes[i >> 2] |= value << ((i & 3) * 8);
+}
+
+// frames the node by its bounds and quantizes the bounds of the children to 8 bits per axis, rounding outwards.
+// the scale leaves one step of headroom for the rounding. refit.comp encodes the same way.
+GpuNode EncodeNode(const Bbox &bbox, const Bbox *children, uint32_t child_mask) {
+    GpuNode node {};
+    const bool is_valid = glm::all(glm::lessThanEqual(bbox.pmin, bbox.pmax));
+    node.origin = is_valid ? bbox.pmin : glm::vec3(0.0f);
+    node.exps_mask = child_mask << 24;
+    int exps[3];
+    for (uint32_t axis = 0; axis < 3; axis++) {
+        int e = 0;
+        if (is_valid) {
+            std::frexp((bbox.pmax[axis] - bbox.pmin[axis]) * (1.0f / 254.0f), &e);
+        }
+        exps[axis] = std::clamp(e, kMinExponent, kMaxExponent);
+        node.exps_mask |= static_cast<uint32_t>(exps[axis] + kExponentBias) << (axis * 8);
+    }
+
+    for (uint32_t i = 0; i < 8; i++) {
+        const auto &child = children[i];
+        if ((child_mask & (1u << i)) == 0 || !is_valid || glm::any(glm::greaterThan(child.pmin, child.pmax))) {
+            for (uint32_t axis = 0; axis < 3; axis++) {
+                SetChildByte(node.child_min, axis, i, 255);
+            }
+            continue;
+        }
+        for (uint32_t axis = 0; axis < 3; axis++) {
+            const float origin = node.origin[axis];
+            const int e = exps[axis];
+            int q_min = std::clamp(static_cast<int>(std::floor(std::ldexp(child.pmin[axis] - origin, -e))), 0, 255);
+            while (q_min > 0 && origin + std::ldexp(static_cast<float>(q_min), e) > child.pmin[axis]) {
+                --q_min;
+            }
+            int q_max = std::clamp(static_cast<int>(std::ceil(std::ldexp(child.pmax[axis] - origin, -e))), 0, 255);
+            while (q_max < 255 && origin + std::ldexp(static_cast<float>(q_max), e) < child.pmax[axis]) {
+                ++q_max;
+            }
+            SetChildByte(node.child_min, axis, i, q_min);
+            SetChildByte(node.child_max, axis, i, q_max);
+        }
+    }
+    return node;
+}
+
+Bbox LooseBbox(const Bbox &bbox) {
+    auto margin = (bbox.pmax - bbox.pmin) * kLooseBoundsScale;
+    return Bbox { bbox.pmin - margin, bbox.pmax + margin };
+}
+
+bool Contains(const Bbox &outer, const Bbox &inner) {
+    return glm::all(glm::lessThanEqual(outer.pmin, inner.pmin)) && glm::all(glm::lessThanEqual(inner.pmax, outer.pmax));
+}
+
+float SurfaceArea(const Bbox &bbox) {
+    auto d = glm::max(bbox.pmax - bbox.pmin, glm::vec3(0.0f));
+    return 2.0f * (d.x * d.y + d.y * d.z + d.z * d.x);
+}
+
+bool IsLeaf(const HierarchyCuller::Node &node) {
+    return std::all_of(node.ch, node.ch + 8, [](int c) { return c < 0; });
+}
+
+}
+
+HierarchyCuller::HierarchyCuller(const Scene &scene) : scene_(scene) {
+    CreateComputeProgram(node_cull_program_, kShaderSourceDir / "hierarchy/node_test.comp");
+    CreateComputeProgram(init_buffer_program_, kShaderSourceDir / "hierarchy/init_buffer.comp");
+    CreateComputeProgram(calc_args_program_, kShaderSourceDir / "hierarchy/calc_args.comp");
+    CreateComputeProgram(calc_expand_args_program_, kShaderSourceDir / "hierarchy/calc_expand_args.comp");
+    CreateComputeProgram(expand_program_, kShaderSourceDir / "hierarchy/expand.comp");
+    CreateComputeProgram(update_program_, kShaderSourceDir / "hierarchy/update.comp");
+    CreateComputeProgram(refit_program_, kShaderSourceDir / "hierarchy/refit.comp");
+    CreateComputeProgram(traverse_program_, kShaderSourceDir / "hierarchy/traverse.comp");
+    CreateComputeProgram(gather_proxies_program_, kShaderSourceDir / "hierarchy/gather_proxies.comp");
+    CreateComputeProgram(sorted_draws_program_, kShaderSourceDir / "hierarchy/sorted_draws.comp");
+    CreateComputeProgram(gather_queue_program_, kShaderSourceDir / "hierarchy/gather_queue.comp");
+
+    // one work group per multiprocessor, so that all of them are likely resident at once
+    persistent_work_groups_ = kPersistentWorkGroups;
+    if (GLAD_GL_NV_shader_thread_group) {
+        int sm_count = 0;
+        glGetIntegerv(GL_SM_COUNT_NV, &sm_count);
+        if (sm_count > 0) {
+            persistent_work_groups_ = static_cast<uint32_t>(sm_count);
+        }
+    }
+
+    camera_info_buffer_ = std::make_unique<GlBuffer>(sizeof(CameraInfo), GL_DYNAMIC_STORAGE_BIT);
+
+    dispatch_args_buffer_ = std::make_unique<GlBuffer>(sizeof(uint32_t) * 3);
+    update_params_buffer_ = std::make_unique<GlBuffer>(sizeof(UpdateParams), GL_DYNAMIC_STORAGE_BIT);
+    refit_params_buffer_ = std::make_unique<GlBuffer>(sizeof(RefitParams), GL_DYNAMIC_STORAGE_BIT);
+
+    // visible instances are gathered into per model and lod ranges of the draw list,
+    // the draw of lod `l` of model `m` is `m * Model::kMaxLods + l`
+    std::vector<uint32_t> instance_models;
+    model_instances_count_.resize(scene.ModelsCount(), 0);
+    scene.ForEachInstance([&](const Scene::Instance &inst, const Model &model) {
+        instance_models.push_back(inst.model);
+        ++model_instances_count_[inst.model];
+    });
+    std::vector<DrawArguments> draw_args(scene.ModelsCount() * Model::kMaxLods, DrawArguments {});
+    uint32_t first_instance = 0;
+    for (size_t i = 0; i < scene.ModelsCount(); i++) {
+        const auto &model = scene.GetModel(i);
+        const auto &lods = model.Lods();
+        for (size_t lod = 0; lod < lods.size(); lod++) {
+            draw_args[i * Model::kMaxLods + lod] = DrawArguments {
+                .num_indices = lods[lod].num_indices,
+                .first_index = model.FirstIndex() + lods[lod].first_index,
+                .vertex_offset = model.VertexOffset(),
+                .instance_count = 0,
+                .first_instance = first_instance,
+            };
+            first_instance += model_instances_count_[i];
+        }
+    }
+    instance_model_buffer_ = std::make_unique<GlBuffer>(instance_models.size() * sizeof(uint32_t), 0,
+        instance_models.data());
+    std::vector<float> model_min_pixel_areas(scene.ModelsCount());
+    for (size_t i = 0; i < scene.ModelsCount(); i++) {
+        model_min_pixel_areas[i] = scene.ModelMinPixelArea(i);
+    }
+    model_min_pixel_area_buffer_ = std::make_unique<GlBuffer>(model_min_pixel_areas.size() * sizeof(float), 0,
+        model_min_pixel_areas.data());
+    model_lod_buffer_ = CreateModelLodBuffer(scene);
+    init_draw_args_buffer_ = std::make_unique<GlBuffer>(draw_args.size() * sizeof(DrawArguments), 0,
+        draw_args.data());
+    draw_args_buffer_ = std::make_unique<GlBuffer>(draw_args.size() * sizeof(DrawArguments));
+    draw_list_buffer_ = std::make_unique<GlBuffer>(first_instance * sizeof(uint32_t));
+    // visible instances are sorted by their draw followed by 16 bits of view depth, more than 65536 draws need keys
+    // of more than 32 bits
+    draw_sort_key_bits_ = 16 + std::bit_width(static_cast<uint32_t>(draw_args.size() - 1));
+    draw_sort_ = std::make_unique<RadixSort>(scene.InstancesCount(), draw_sort_key_bits_);
+
+    proxy_draw_args_buffer_ = std::make_unique<GlBuffer>(sizeof(ProxyDrawArguments));
+
+    // the readback holds the stats followed by the draw arguments of the instances and of the proxies
+    stats_buffer_ = std::make_unique<GlBuffer>(sizeof(CullStats));
+    stats_readback_ = std::make_unique<GlReadbackBuffer>(sizeof(CullStats) + draw_args.size() * sizeof(DrawArguments)
+        + sizeof(ProxyDrawArguments), kStatsReadbackCopies);
+}
+
+void HierarchyCuller::SetHierarchy(const std::vector<Node> &nodes, const std::vector<uint32_t> &instances) {
+    nodes_ = nodes;
+
+    node_parents_.assign(nodes_.size(), -1);
+    node_levels_.assign(nodes_.size(), 0);
+    for (size_t u = 0; u < nodes_.size(); u++) {
+        for (auto c : nodes_[u].ch) {
+            if (c >= 0) {
+                node_parents_[c] = u;
+                node_levels_[c] = node_levels_[u] + 1;
+            }
+        }
+    }
+
+    // lay the leaves out in the order of their instances, so that every subtree still spans a contiguous range
+    std::vector<uint32_t> leaves;
+    for (size_t u = 0; u < nodes_.size(); u++) {
+        if (IsLeaf(nodes_[u])) {
+            leaves.push_back(u);
+        }
+    }
+    std::sort(leaves.begin(), leaves.end(), [this](uint32_t a, uint32_t b) {
+        return nodes_[a].first_instance < nodes_[b].first_instance;
+    });
+    slots_.clear();
+    leaf_sizes_.assign(nodes_.size(), 0);
+    loose_bboxes_.assign(nodes_.size(), Bbox {});
+    instance_leaves_.assign(scene_.InstancesCount(), kNoLeaf);
+    instance_slots_.resize(scene_.InstancesCount());
+    for (auto leaf : leaves) {
+        auto &node = nodes_[leaf];
+        const uint32_t first_slot = slots_.size();
+        for (uint32_t i = 0; i < node.num_instances; i++) {
+            auto inst_id = instances[node.first_instance + i];
+            instance_leaves_[inst_id] = leaf;
+            instance_slots_[inst_id] = slots_.size();
+            slots_.push_back(inst_id);
+        }
+        slots_.insert(slots_.end(), kLeafFreeSlots, kEmptySlot);
+        leaf_sizes_[leaf] = node.num_instances;
+        loose_bboxes_[leaf] = LooseBbox(node.bbox);
+        node.first_instance = first_slot;
+        node.num_instances = slots_.size() - first_slot;
+    }
+    for (size_t u = nodes_.size(); u-- > 0;) {
+        auto &node = nodes_[u];
+        if (IsLeaf(node)) {
+            continue;
+        }
+        uint32_t first = ~0u;
+        uint32_t last = 0;
+        for (auto c : node.ch) {
+            if (c >= 0) {
+                first = std::min(first, nodes_[c].first_instance);
+                last = std::max(last, nodes_[c].first_instance + nodes_[c].num_instances);
+            }
+        }
+        node.first_instance = first;
+        node.num_instances = last - first;
+    }
+    dirty_nodes_.assign(nodes_.size(), false);
+
+    // number internal nodes and leaves breadth first, so that the children of each kind are consecutive
+    std::vector<int> internal_nodes { -1 };
+    std::vector<uint32_t> leaf_nodes;
+    std::vector<GpuNode> gpu_nodes;
+    std::vector<GpuNodeLinks> gpu_links;
+    gpu_ids_.assign(nodes_.size(), 0);
+    num_levels_ = 1;
+    for (size_t i = 0; i < internal_nodes.size(); i++) {
+        const int u = internal_nodes[i];
+        const auto &node = nodes_[std::max(u, 0)];
+        std::array<int, 8> children;
+        if (u < 0) {
+            children.fill(-1);
+            children[0] = 0;
+        } else {
+            std::copy_n(node.ch, 8, children.begin());
+            num_levels_ = std::max(num_levels_, node_levels_[u] + 2);
+        }
+
+        GpuNodeLinks links {
+            .first_internal = static_cast<uint32_t>(internal_nodes.size()),
+            .first_leaf_mask = static_cast<uint32_t>(leaf_nodes.size()),
+            .first_instance = node.first_instance,
+            .num_instances = node.num_instances,
+        };
+        Bbox child_bboxes[8];
+        uint32_t child_mask = 0;
+        for (uint32_t k = 0; k < 8; k++) {
+            const int c = children[k];
+            if (c < 0) {
+                continue;
+            }
+            if (IsLeaf(nodes_[c])) {
+                gpu_ids_[c] = leaf_nodes.size() | kLeafBit;
+                leaf_nodes.push_back(c);
+                links.first_leaf_mask |= 1u << (24 + k);
+            } else {
+                gpu_ids_[c] = internal_nodes.size();
+                internal_nodes.push_back(c);
+            }
+            child_bboxes[k] = nodes_[c].bbox;
+            child_mask |= 1u << k;
+        }
+        gpu_nodes.push_back(EncodeNode(node.bbox, child_bboxes, child_mask));
+        gpu_links.push_back(links);
+    }
+    num_internal_nodes_ = internal_nodes.size();
+    num_leaves_ = leaf_nodes.size();
+
+    std::vector<GpuLeaf> gpu_leaves;
+    std::vector<Bbox> node_bboxes;
+    for (auto u : internal_nodes) {
+        node_bboxes.push_back(nodes_[std::max(u, 0)].bbox);
+    }
+    for (auto u : leaf_nodes) {
+        gpu_leaves.push_back(GpuLeaf { nodes_[u].first_instance, nodes_[u].num_instances });
+        node_bboxes.push_back(nodes_[u].bbox);
+    }
+
+    std::vector<Rasterizer::InstanceTransform> transforms;
+    std::vector<Bbox> instance_bboxes;
+    scene_.ForEachInstance([&](const Scene::Instance &inst, const Model &model) {
+        transforms.push_back(Rasterizer::MakeInstanceTransform(inst.transform));
+        instance_bboxes.push_back(inst.bbox);
+    });
+    transform_buffer_ = std::make_unique<GlBuffer>(transforms.size() * sizeof(Rasterizer::InstanceTransform), 0,
+        transforms.data());
+    instance_bbox_buffer_ = std::make_unique<GlBuffer>(instance_bboxes.size() * sizeof(Bbox), 0,
+        instance_bboxes.data());
+
+    hierarchy_buffer_ = std::make_unique<GlBuffer>(gpu_nodes.size() * sizeof(GpuNode), 0, gpu_nodes.data());
+    hierarchy_link_buffer_ = std::make_unique<GlBuffer>(gpu_links.size() * sizeof(GpuNodeLinks), 0,
+        gpu_links.data());
+    hierarchy_leaf_buffer_ = std::make_unique<GlBuffer>(gpu_leaves.size() * sizeof(GpuLeaf), 0,
+        gpu_leaves.data());
+    node_bbox_buffer_ = std::make_unique<GlBuffer>(node_bboxes.size() * sizeof(Bbox), 0, node_bboxes.data());
+    hierarchy_instance_buffer_ = std::make_unique<GlBuffer>(slots_.size() * sizeof(uint32_t), 0, slots_.data());
+    // only internal nodes are traversed, leaves are emitted by their parents
+    auto io_nodes_buffer_size = (num_internal_nodes_ + 1) * sizeof(uint32_t);
+    io_nodes_buffer_[0] = std::make_unique<GlBuffer>(io_nodes_buffer_size);
+    io_nodes_buffer_[1] = std::make_unique<GlBuffer>(io_nodes_buffer_size);
+    visible_nodes_buffer_ = std::make_unique<GlBuffer>((num_internal_nodes_ + num_leaves_ + 1) * sizeof(uint32_t));
+    // head, tail and the number of pending nodes, followed by the queued nodes
+    work_queue_buffer_ = std::make_unique<GlBuffer>((3 + num_internal_nodes_) * sizeof(uint32_t),
+        GL_DYNAMIC_STORAGE_BIT);
+    refit_nodes_buffer_ = std::make_unique<GlBuffer>((nodes_.size() + 1) * sizeof(uint32_t), GL_DYNAMIC_STORAGE_BIT);
+    // every moved instance changes at most 3 slots
+    slot_update_buffer_ = std::make_unique<GlBuffer>(scene_.InstancesCount() * 3 * sizeof(glm::uvec2),
+        GL_DYNAMIC_STORAGE_BIT);
+
+    // no proxies until they are baked
+    has_proxy_.assign(nodes_.size(), false);
+    num_proxies_ = 0;
+    num_proxy_indices_ = 0;
+    std::vector<GpuProxy> gpu_proxies(num_internal_nodes_, GpuProxy { 0, 0 });
+    node_proxy_buffer_ = std::make_unique<GlBuffer>(gpu_proxies.size() * sizeof(GpuProxy), GL_DYNAMIC_STORAGE_BIT,
+        gpu_proxies.data());
+    proxy_nodes_buffer_ = std::make_unique<GlBuffer>((num_internal_nodes_ + 1) * sizeof(uint32_t));
+}
+
+// proxies are baked bottom-up, a node merges the proxies of its internal children with the coarsest lods of the
+// instances in its leaf children, so every bake only touches a bounded amount of geometry
+void HierarchyCuller::BakeProxies() {
+    const auto start_time = std::chrono::steady_clock::now();
+
+    std::vector<HlodMesh> proxies(nodes_.size());
+    std::vector<GpuProxy> gpu_proxies(num_internal_nodes_, GpuProxy { 0, 0 });
+    HlodMesh proxy_mesh;
+    for (size_t u = nodes_.size(); u-- > 0;) {
+        if (IsLeaf(nodes_[u])) {
+            continue;
+        }
+        HlodMesh merged;
+        for (auto c : nodes_[u].ch) {
+            if (c < 0) {
+                continue;
+            }
+            if (!IsLeaf(nodes_[c])) {
+                merged.Append(proxies[c]);
+                proxies[c] = HlodMesh {};
+                continue;
+            }
+            for (uint32_t i = 0; i < nodes_[c].num_instances; i++) {
+                const auto inst_id = slots_[nodes_[c].first_instance + i];
+                if (inst_id != kEmptySlot) {
+                    const auto &inst = scene_.GetInstance(inst_id);
+                    const auto &model = scene_.GetModel(inst.model);
+                    merged.Append(model, model.Lods().back(), inst.transform);
+                }
+            }
+        }
+        proxies[u] = ClusterVertices(merged, nodes_[u].bbox, kHlodGridResolution);
+
+        gpu_proxies[gpu_ids_[u]] = GpuProxy {
+            .first_index = static_cast<uint32_t>(proxy_mesh.indices.size()),
+            .num_indices = static_cast<uint32_t>(proxies[u].indices.size()),
+        };
+        has_proxy_[u] = !proxies[u].indices.empty();
+        proxy_mesh.Append(proxies[u]);
+    }
+    num_proxies_ = std::count(has_proxy_.begin(), has_proxy_.end(), true);
+    num_proxy_indices_ = proxy_mesh.indices.size();
+    if (num_proxies_ == 0) {
+        return;
+    }
+
+    glNamedBufferSubData(node_proxy_buffer_->Id(), 0, gpu_proxies.size() * sizeof(GpuProxy), gpu_proxies.data());
+    proxy_position_buffer_ = std::make_unique<GlBuffer>(proxy_mesh.positions.size() * sizeof(glm::vec3), 0,
+        proxy_mesh.positions.data());
+    proxy_normal_buffer_ = std::make_unique<GlBuffer>(proxy_mesh.normals.size() * sizeof(glm::vec3), 0,
+        proxy_mesh.normals.data());
+    proxy_index_buffer_ = std::make_unique<GlBuffer>(proxy_mesh.indices.size() * sizeof(uint32_t), 0,
+        proxy_mesh.indices.data());
+    // in the worst case every proxy is drawn
+    proxy_draw_index_buffer_ = std::make_unique<GlBuffer>(proxy_mesh.indices.size() * sizeof(uint32_t));
+
+    const std::chrono::duration<double, std::milli> bake_time = std::chrono::steady_clock::now() - start_time;
+    std::cout << "HLOD: " << num_proxies_ << " proxies, " << num_proxy_indices_ / 3 << " triangles, baked in "
+        << bake_time.count() << " ms\n";
+}
+
+bool HierarchyCuller::UpdateInstances(const std::vector<uint32_t> &instances) {
+    if (instances.empty()) {
+        return true;
+    }
+
+    std::vector<InstanceUpdate> instance_updates;
+    std::vector<uint32_t> dirty_slots;
+    for (auto inst_id : instances) {
+        const auto &inst = scene_.GetInstance(inst_id);
+        instance_updates.push_back(InstanceUpdate {
+            .model = Rasterizer::MakeInstanceTransform(inst.transform).model,
+            .bbox = inst.bbox,
+            .instance = inst_id,
+        });
+
+        // removed instances leave their leaf, added ones are inserted like moved ones
+        const auto leaf = instance_leaves_[inst_id];
+        if (leaf != kNoLeaf) {
+            MarkDirty(leaf);
+            if (inst.alive && Contains(loose_bboxes_[leaf], inst.bbox)) {
+                continue;
+            }
+        }
+
+        const auto new_leaf = inst.alive ? FindLeaf(inst.bbox) : kNoLeaf;
+        if (new_leaf == leaf) {
+            if (leaf != kNoLeaf) {
+                loose_bboxes_[leaf].Merge(inst.bbox);
+            }
+            continue;
+        }
+        if (new_leaf != kNoLeaf && leaf_sizes_[new_leaf] == nodes_[new_leaf].num_instances) {
+            return false;
+        }
+
+        // the last instance of the old leaf fills the hole
+        if (leaf != kNoLeaf) {
+            const auto slot = instance_slots_[inst_id];
+            const auto last_slot = nodes_[leaf].first_instance + --leaf_sizes_[leaf];
+            slots_[slot] = slots_[last_slot];
+            instance_slots_[slots_[slot]] = slot;
+            slots_[last_slot] = kEmptySlot;
+            dirty_slots.insert(dirty_slots.end(), { slot, last_slot });
+        }
+        instance_leaves_[inst_id] = new_leaf;
+        if (new_leaf == kNoLeaf) {
+            continue;
+        }
+
+        const auto new_slot = nodes_[new_leaf].first_instance + leaf_sizes_[new_leaf]++;
+        slots_[new_slot] = inst_id;
+        instance_slots_[inst_id] = new_slot;
+        dirty_slots.push_back(new_slot);
+
+        loose_bboxes_[new_leaf].Merge(inst.bbox);
+        for (int u = new_leaf; u >= 0; u = node_parents_[u]) {
+            nodes_[u].bbox.Merge(inst.bbox);
+        }
+        MarkDirty(new_leaf);
+    }
+
+    // a slot may change several times in one batch, only its final value is uploaded
+    std::sort(dirty_slots.begin(), dirty_slots.end());
+    dirty_slots.erase(std::unique(dirty_slots.begin(), dirty_slots.end()), dirty_slots.end());
+    std::vector<glm::uvec2> slot_updates;
+    for (auto slot : dirty_slots) {
+        slot_updates.push_back(glm::uvec2(slot, slots_[slot]));
+    }
+
+    // dirty nodes are refitted from the deepest level up, the virtual root is requantized last
+    std::vector<uint32_t> refit_nodes;
+    for (size_t u = 0; u < nodes_.size(); u++) {
+        if (dirty_nodes_[u]) {
+            refit_nodes.push_back(u);
+            dirty_nodes_[u] = false;
+        }
+    }
+    std::stable_sort(refit_nodes.begin(), refit_nodes.end(), [this](uint32_t a, uint32_t b) {
+        return node_levels_[a] > node_levels_[b];
+    });
+    std::vector<uint32_t> gpu_refit_nodes;
+    for (auto u : refit_nodes) {
+        gpu_refit_nodes.push_back(gpu_ids_[u]);
+        // the proxy no longer matches the moved instances
+        if (has_proxy_[u]) {
+            has_proxy_[u] = false;
+            --num_proxies_;
+            const GpuProxy no_proxy { 0, 0 };
+            glNamedBufferSubData(node_proxy_buffer_->Id(), gpu_ids_[u] * sizeof(GpuProxy), sizeof(GpuProxy),
+                &no_proxy);
+        }
+    }
+    gpu_refit_nodes.push_back(0);
+    auto refit_level = [&](size_t i) {
+        return i < refit_nodes.size() ? static_cast<int>(node_levels_[refit_nodes[i]]) : -1;
+    };
+
+    // all updates of the batch are uploaded at once and scattered on the GPU
+    const size_t instance_updates_size = instance_updates.size() * sizeof(InstanceUpdate);
+    if (instance_update_buffer_ == nullptr || instance_update_buffer_->Size() < instance_updates_size) {
+        instance_update_buffer_ = std::make_unique<GlBuffer>(instance_updates_size, GL_DYNAMIC_STORAGE_BIT);
+    }
+    glNamedBufferSubData(instance_update_buffer_->Id(), 0, instance_updates_size, instance_updates.data());
+    if (!slot_updates.empty()) {
+        glNamedBufferSubData(slot_update_buffer_->Id(), 0, slot_updates.size() * sizeof(glm::uvec2),
+            slot_updates.data());
+    }
+    glNamedBufferSubData(refit_nodes_buffer_->Id(), 0, gpu_refit_nodes.size() * sizeof(uint32_t),
+        gpu_refit_nodes.data());
+    UpdateParams update_params {
+        .num_instances = static_cast<uint32_t>(instance_updates.size()),
+        .num_slots = static_cast<uint32_t>(slot_updates.size()),
+    };
+    glNamedBufferSubData(update_params_buffer_->Id(), 0, sizeof(UpdateParams), &update_params);
+
+    glUseProgram(update_program_->Id());
+    glBindBufferBase(GL_UNIFORM_BUFFER, 0, update_params_buffer_->Id());
+    uint32_t update_buffers[] = {
+        instance_update_buffer_->Id(),
+        slot_update_buffer_->Id(),
+        transform_buffer_->Id(),
+        instance_bbox_buffer_->Id(),
+        hierarchy_instance_buffer_->Id(),
+    };
+    glBindBuffersBase(GL_SHADER_STORAGE_BUFFER, 1, 5, update_buffers);
+    const uint32_t num_updates = std::max(update_params.num_instances, update_params.num_slots);
+    glDispatchCompute((num_updates + kComputeWorkGroupSize - 1) / kComputeWorkGroupSize, 1, 1);
+    glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+    glUseProgram(refit_program_->Id());
+    glBindBufferBase(GL_UNIFORM_BUFFER, 0, refit_params_buffer_->Id());
+    uint32_t refit_buffers[] = {
+        refit_nodes_buffer_->Id(),
+        hierarchy_buffer_->Id(),
+        hierarchy_instance_buffer_->Id(),
+        instance_bbox_buffer_->Id(),
+        hierarchy_link_buffer_->Id(),
+        hierarchy_leaf_buffer_->Id(),
+        node_bbox_buffer_->Id(),
+    };
+    glBindBuffersBase(GL_SHADER_STORAGE_BUFFER, 1, 7, refit_buffers);
+    for (size_t first = 0; first < gpu_refit_nodes.size();) {
+        size_t last = first;
+        while (last < gpu_refit_nodes.size() && refit_level(last) == refit_level(first)) {
+            ++last;
+        }
+        RefitParams refit_params {
+            .first_node = static_cast<uint32_t>(first),
+            .num_nodes = static_cast<uint32_t>(last - first),
+            .num_internal_nodes = num_internal_nodes_,
+        };
+        glNamedBufferSubData(refit_params_buffer_->Id(), 0, sizeof(RefitParams), &refit_params);
+        glDispatchCompute((refit_params.num_nodes + kComputeWorkGroupSize - 1) / kComputeWorkGroupSize, 1, 1);
+        glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+        first = last;
+    }
+    glUseProgram(0);
+
+    return true;
+}
+
+void HierarchyCuller::Cull(const HiZBuffer &hiz_buffer, const glm::mat4 &view_proj, float min_pixel_area_scale,
+    float lod_pixel_scale, float max_lod_error, bool front_to_back) {
+    front_to_back_ = front_to_back;
+    PollStats();
+
+    CameraInfo camera {
+        .view_proj = view_proj,
+        .screen_size = glm::vec2(hiz_buffer.Width(), hiz_buffer.Height()),
+        .min_pixel_area_scale = min_pixel_area_scale,
+        .lod_pixel_scale = lod_pixel_scale,
+        .max_lod_error = max_lod_error,
+        // 0 turns proxies off
+        .hlod_max_pixels = num_proxies_ > 0 ? hlod_max_pixels_ : 0.0f,
+        // the number of words of the sort keys
+        .sort_draws = front_to_back_ ? (draw_sort_key_bits_ > 32 ? 2u : 1u) : 0u,
+    };
+    glNamedBufferSubData(camera_info_buffer_->Id(), 0, sizeof(CameraInfo), &camera);
+
+    size_t curr_in_buffer = 0;
+
+    glUseProgram(init_buffer_program_->Id());
+    uint32_t init_buffers[] = {
+        io_nodes_buffer_[curr_in_buffer]->Id(),
+        visible_nodes_buffer_->Id(),
+        stats_buffer_->Id(),
+        proxy_nodes_buffer_->Id(),
+    };
+    glBindBuffersBase(GL_SHADER_STORAGE_BUFFER, 0, 4, init_buffers);
+    glDispatchCompute(1, 1, 1);
+    glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+    glBindBuffer(GL_DISPATCH_INDIRECT_BUFFER, dispatch_args_buffer_->Id());
+    if (persistent_traversal_) {
+        // the queue starts with the root as its only pending node
+        uint32_t empty_slot = kEmptySlot;
+        glClearNamedBufferData(work_queue_buffer_->Id(), GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, &empty_slot);
+        const uint32_t queue_header[] = { 0, 1, 1, 0 };
+        glNamedBufferSubData(work_queue_buffer_->Id(), 0, sizeof(queue_header), queue_header);
+
+        glUseProgram(traverse_program_->Id());
+        hiz_buffer.Bind(0, 2);
+        glBindBufferBase(GL_UNIFORM_BUFFER, 1, camera_info_buffer_->Id());
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, hierarchy_buffer_->Id());
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, work_queue_buffer_->Id());
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 5, visible_nodes_buffer_->Id());
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 6, stats_buffer_->Id());
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 7, hierarchy_link_buffer_->Id());
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 8, node_proxy_buffer_->Id());
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 9, proxy_nodes_buffer_->Id());
+        glDispatchCompute(persistent_work_groups_, 1, 1);
+        glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+        // the nodes the traversal gave up on are tested level by level, the passes are empty if there are none
+        const uint32_t zero = 0;
+        glClearNamedBufferSubData(io_nodes_buffer_[curr_in_buffer]->Id(), GL_R32UI, 0, sizeof(uint32_t),
+            GL_RED_INTEGER, GL_UNSIGNED_INT, &zero);
+        glUseProgram(gather_queue_program_->Id());
+        uint32_t gather_queue_buffers[] = {
+            work_queue_buffer_->Id(),
+            io_nodes_buffer_[curr_in_buffer]->Id(),
+        };
+        glBindBuffersBase(GL_SHADER_STORAGE_BUFFER, 0, 2, gather_queue_buffers);
+        glDispatchCompute((num_internal_nodes_ + kComputeWorkGroupSize - 1) / kComputeWorkGroupSize, 1, 1);
+        glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+    }
+
+    // level by level, or only the nodes left over by the persistent traversal
+    for (uint32_t i = 0; i < num_levels_; i++) {
+        glUseProgram(calc_args_program_->Id());
+        uint32_t calc_args_buffers[] = {
+            io_nodes_buffer_[curr_in_buffer]->Id(),
+            io_nodes_buffer_[curr_in_buffer ^ 1]->Id(),
+            dispatch_args_buffer_->Id(),
+        };
+        glBindBuffersBase(GL_SHADER_STORAGE_BUFFER, 0, 3, calc_args_buffers);
+        glDispatchCompute(1, 1, 1);
+        glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT | GL_COMMAND_BARRIER_BIT);
+
+        glUseProgram(node_cull_program_->Id());
+        hiz_buffer.Bind(0, 2);
+        glBindBufferBase(GL_UNIFORM_BUFFER, 1, camera_info_buffer_->Id());
+        uint32_t cull_buffers[] = {
+            hierarchy_buffer_->Id(),
+            io_nodes_buffer_[curr_in_buffer]->Id(),
+            io_nodes_buffer_[curr_in_buffer ^ 1]->Id(),
+            visible_nodes_buffer_->Id(),
+            stats_buffer_->Id(),
+            hierarchy_link_buffer_->Id(),
+            node_proxy_buffer_->Id(),
+            proxy_nodes_buffer_->Id(),
+        };
+        glBindBuffersBase(GL_SHADER_STORAGE_BUFFER, 2, 8, cull_buffers);
+        glDispatchComputeIndirect(0);
+        glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+        curr_in_buffer ^= 1;
+    }
+
+    // expand visible nodes into instances, every instance is in exactly one leaf so nothing is emitted twice
+    glCopyNamedBufferSubData(init_draw_args_buffer_->Id(), draw_args_buffer_->Id(), 0, 0,
+        draw_args_buffer_->Size());
+
+    glUseProgram(calc_expand_args_program_->Id());
+    uint32_t calc_expand_args_buffers[] = {
+        visible_nodes_buffer_->Id(),
+        dispatch_args_buffer_->Id(),
+    };
+    glBindBuffersBase(GL_SHADER_STORAGE_BUFFER, 0, 2, calc_expand_args_buffers);
+    glDispatchCompute(1, 1, 1);
+    glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT | GL_COMMAND_BARRIER_BIT);
+
+    glUseProgram(expand_program_->Id());
+    glBindBufferBase(GL_UNIFORM_BUFFER, 0, camera_info_buffer_->Id());
+    uint32_t expand_buffers[] = {
+        hierarchy_link_buffer_->Id(),
+        visible_nodes_buffer_->Id(),
+        hierarchy_instance_buffer_->Id(),
+        instance_model_buffer_->Id(),
+        draw_args_buffer_->Id(),
+        draw_list_buffer_->Id(),
+        hierarchy_leaf_buffer_->Id(),
+        instance_bbox_buffer_->Id(),
+        model_min_pixel_area_buffer_->Id(),
+        stats_buffer_->Id(),
+        model_lod_buffer_->Id(),
+    };
+    glBindBuffersBase(GL_SHADER_STORAGE_BUFFER, 1, 11, expand_buffers);
+    uint32_t sort_buffers[] = {
+        draw_sort_->CountBuffer()->Id(),
+        draw_sort_->KeyBuffer()->Id(),
+        draw_sort_->ValueBuffer()->Id(),
+    };
+    glBindBuffersBase(GL_SHADER_STORAGE_BUFFER, 12, 3, sort_buffers);
+    if (draw_sort_->HighKeyBuffer()) {
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 15, draw_sort_->HighKeyBuffer()->Id());
+    }
+    uint32_t zero = 0;
+    if (front_to_back_) {
+        glClearNamedBufferData(draw_sort_->CountBuffer()->Id(), GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, &zero);
+    }
+    glDispatchComputeIndirect(0);
+    glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT | GL_BUFFER_UPDATE_BARRIER_BIT);
+
+    // the sorted instances are drawn instead of the draw list, each draw starts at its first sorted instance
+    if (front_to_back_) {
+        draw_sort_->Sort(draw_sort_key_bits_);
+
+        glUseProgram(sorted_draws_program_->Id());
+        glBindBufferBase(GL_UNIFORM_BUFFER, 0, camera_info_buffer_->Id());
+        uint32_t sorted_draws_buffers[] = {
+            draw_sort_->CountBuffer()->Id(),
+            draw_sort_->KeyBuffer()->Id(),
+            draw_args_buffer_->Id(),
+        };
+        glBindBuffersBase(GL_SHADER_STORAGE_BUFFER, 0, 3, sorted_draws_buffers);
+        if (draw_sort_->HighKeyBuffer()) {
+            glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, draw_sort_->HighKeyBuffer()->Id());
+        }
+        glDispatchCompute((static_cast<uint32_t>(scene_.InstancesCount()) + kComputeWorkGroupSize - 1)
+            / kComputeWorkGroupSize, 1, 1);
+        glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT | GL_BUFFER_UPDATE_BARRIER_BIT);
+    }
+
+    // copy the indices of the proxies to draw into one index buffer
+    glClearNamedBufferData(proxy_draw_args_buffer_->Id(), GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, &zero);
+    if (num_proxies_ > 0) {
+        glUseProgram(calc_expand_args_program_->Id());
+        uint32_t calc_gather_args_buffers[] = {
+            proxy_nodes_buffer_->Id(),
+            dispatch_args_buffer_->Id(),
+        };
+        glBindBuffersBase(GL_SHADER_STORAGE_BUFFER, 0, 2, calc_gather_args_buffers);
+        glDispatchCompute(1, 1, 1);
+        glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT | GL_COMMAND_BARRIER_BIT);
+
+        glUseProgram(gather_proxies_program_->Id());
+        uint32_t gather_buffers[] = {
+            proxy_nodes_buffer_->Id(),
+            node_proxy_buffer_->Id(),
+            proxy_index_buffer_->Id(),
+            proxy_draw_args_buffer_->Id(),
+            proxy_draw_index_buffer_->Id(),
+            stats_buffer_->Id(),
+        };
+        glBindBuffersBase(GL_SHADER_STORAGE_BUFFER, 0, 6, gather_buffers);
+        glDispatchComputeIndirect(0);
+        glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT | GL_BUFFER_UPDATE_BARRIER_BIT);
+    }
+
+    glUseProgram(0);
+    glBindBuffer(GL_DISPATCH_INDIRECT_BUFFER, 0);
+
+    stats_readback_->Copy(stats_buffer_->Id(), 0, 0, sizeof(CullStats));
+    stats_readback_->Copy(draw_args_buffer_->Id(), 0, sizeof(CullStats), draw_args_buffer_->Size());
+    stats_readback_->Copy(proxy_draw_args_buffer_->Id(), 0, sizeof(CullStats) + draw_args_buffer_->Size(),
+        sizeof(ProxyDrawArguments));
+    stats_readback_->Submit();
+}
+
+bool HierarchyCuller::PollStats() {
+    if (!stats_readback_->Poll()) {
+        return false;
+    }
+
+    auto p_stats = stats_readback_->TypedData<CullStats>();
+    num_tested_nodes_ = p_stats->num_tested_nodes;
+    num_contribution_culled_ = p_stats->num_contribution_culled;
+    num_drawn_proxies_ = p_stats->num_drawn_proxies;
+    auto p_drawn_args = reinterpret_cast<const DrawArguments *>(p_stats + 1);
+    num_drawn_instances_ = 0;
+    num_drawn_triangles_ = 0;
+    for (size_t i = 0; i < scene_.ModelsCount() * Model::kMaxLods; i++) {
+        num_drawn_instances_ += p_drawn_args[i].instance_count;
+        num_drawn_triangles_ += p_drawn_args[i].instance_count * (p_drawn_args[i].num_indices / 3);
+    }
+    auto p_proxy_args = reinterpret_cast<const ProxyDrawArguments *>(p_drawn_args
+        + scene_.ModelsCount() * Model::kMaxLods);
+    num_drawn_triangles_ += p_proxy_args->num_indices / 3;
+    return true;
+}
+
+void HierarchyCuller::DrawUi() {
+    ImGui::Text("Node tests: %d / %d", num_tested_nodes_, static_cast<uint32_t>(nodes_.size()));
+    ImGui::Text("Contribution culled: %d", num_contribution_culled_);
+    ImGui::Text("Triangles: %d", num_drawn_triangles_);
+    const size_t node_memory = num_internal_nodes_ * (sizeof(GpuNode) + sizeof(GpuNodeLinks))
+        + num_leaves_ * sizeof(GpuLeaf);
+    ImGui::Text("Node memory: %.1f KB", node_memory / 1024.0f);
+    // idle invocations of the persistent traversal spin on nodes queued by other work groups, which may not be
+    // resident. the spinning is bounded and the nodes left over are tested level by level
+    ImGui::Checkbox("Persistent traversal", &persistent_traversal_);
+    if (persistent_traversal_) {
+        ImGui::Text("Persistent work groups: %d, waits on other work groups", persistent_work_groups_);
+    }
+    if (num_proxies_ > 0) {
+        ImGui::Text("HLOD proxies: %d / %d", num_drawn_proxies_, num_proxies_);
+        ImGui::SliderFloat("HLOD node size (px)", &hlod_max_pixels_, 0.0f, 64.0f);
+    }
+}
+
+void HierarchyCuller::Draw(Rasterizer &rasterizer) const {
+    rasterizer.SetTransformBuffer(transform_buffer_.get());
+    rasterizer.SetInstanceBuffer(front_to_back_ ? draw_sort_->ValueBuffer() : draw_list_buffer_.get());
+    const auto &geometry = scene_.GetGeometryPool();
+    rasterizer.SetPositionBuffer(geometry.PositionBuffer());
+    rasterizer.SetNormalBuffer(geometry.NormalBuffer());
+    rasterizer.SetIndexBuffer(geometry.IndexBuffer());
+    for (size_t i = 0; i < scene_.ModelsCount(); i++) {
+        if (model_instances_count_[i] == 0) {
+            continue;
+        }
+        // every instance is drawn with one lod, so the lods of a model are drawn in one call
+        const auto &model = scene_.GetModel(i);
+        uint32_t max_indices = 0;
+        for (size_t lod = 0; lod < model.LodsCount(); lod++) {
+            max_indices = std::max(max_indices, model.Lods()[lod].num_indices);
+        }
+        rasterizer.MultiDrawIndexedInstancedIndirect(draw_args_buffer_.get(),
+            i * Model::kMaxLods * sizeof(DrawArguments), static_cast<uint32_t>(model.LodsCount()), max_indices,
+            model_instances_count_[i]);
+    }
+
+    if (num_proxies_ > 0) {
+        rasterizer.SetMatrixModel(glm::mat4(1.0f));
+        rasterizer.SetPositionBuffer(proxy_position_buffer_.get());
+        rasterizer.SetNormalBuffer(proxy_normal_buffer_.get());
+        rasterizer.SetIndexBuffer(proxy_draw_index_buffer_.get());
+        rasterizer.DrawIndexedIndirect(proxy_draw_args_buffer_.get(), 0, num_proxy_indices_);
+    }
+}
+
+// descends into the child whose bounds grow the least
+uint32_t HierarchyCuller::FindLeaf(const Bbox &bbox) const {
+    uint32_t u = 0;
+    while (!IsLeaf(nodes_[u])) {
+        float best_cost = std::numeric_limits<float>::max();
+        uint32_t best_child = 0;
+        for (auto c : nodes_[u].ch) {
+            if (c < 0) {
+                continue;
+            }
+            auto merged = nodes_[c].bbox;
+            merged.Merge(bbox);
+            float cost = SurfaceArea(merged) - SurfaceArea(nodes_[c].bbox);
+            if (cost < best_cost) {
+                best_cost = cost;
+                best_child = c;
+            }
+        }
+        u = best_child;
+    }
+    return u;
+}
+
+void HierarchyCuller::MarkDirty(uint32_t node) {
+    for (int u = node; u >= 0 && !dirty_nodes_[u]; u = node_parents_[u]) {
+        dirty_nodes_[u] = true;
+    }
+}
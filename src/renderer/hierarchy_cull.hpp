@@ -0,0 +1,153 @@
+#pragma once
+
+#include <memory>
+#include <vector>
+
+#include "scene/scene.hpp"
+#include "rasterizer/rasterizer.hpp"
+#include "glh/readback_buffer.hpp"
+#include "hiz.hpp"
+#include "radix_sort.hpp"
+
+// Hi-Z culling of the scene instances through a bounding volume hierarchy on the GPU.
+// The hierarchy is tested level by level, and the visible nodes are expanded into one instanced draw per model lod.
+// On the GPU an internal node holds the bounds of its children quantized to 8 bits per axis, so a node test
+// reads one cache line and tests all children at once. Leaves only keep their instance range.
+// Moving instances are handled by refitting the node bounds on the GPU. An instance only moves to another leaf
+// when it leaves the loose bounds of its leaf, every leaf keeps a few free slots for that.
+// Internal nodes may have a baked proxy of everything below them. A node that covers only a few pixels draws its
+// proxy instead of being traversed, and all such proxies are gathered into a single draw.
+class HierarchyCuller {
+public:
+    // children that don't exist are -1, a node without children is a leaf.
+    // instances of a node are the range [first_instance, first_instance + num_instances) of the hierarchy instances,
+    // so every instance should sit in exactly one leaf.
+    struct Node {
+        int ch[8];
+        Bbox bbox;
+        uint32_t first_instance;
+        uint32_t num_instances;
+    };
+
+    HierarchyCuller(const Scene &scene);
+
+    // nodes[0] is the root and children come after their parents
+    void SetHierarchy(const std::vector<Node> &nodes, const std::vector<uint32_t> &instances);
+    // bakes the proxies of all internal nodes from the current instance transforms, after SetHierarchy().
+    // a proxy is dropped once an instance below its node moves.
+    void BakeProxies();
+
+    // uploads the current transforms of `instances` from the scene and refits the hierarchy,
+    // returns false if the hierarchy has to be rebuilt since an instance found no free slot
+    bool UpdateInstances(const std::vector<uint32_t> &instances);
+
+    // instances covering fewer pixels than the threshold of their model times `min_pixel_area_scale` are dropped,
+    // the others use the coarsest lod whose error is at most `max_lod_error` pixels, see lod.glsl.
+    // with `front_to_back`, the instances of every draw are sorted by view depth on the GPU
+    void Cull(const HiZBuffer &hiz_buffer, const glm::mat4 &view_proj, float min_pixel_area_scale,
+        float lod_pixel_scale, float max_lod_error, bool front_to_back);
+    void Draw(Rasterizer &rasterizer) const;
+
+    void DrawUi();
+
+    // collects the stats the GPU is done with without waiting, returns true if they changed.
+    // stats arrive one or two frames late
+    bool PollStats();
+    uint32_t NumDrawnInstances() const { return num_drawn_instances_; }
+    uint32_t NumTestedNodes() const { return num_tested_nodes_; }
+    uint32_t NumContributionCulled() const { return num_contribution_culled_; }
+
+private:
+    uint32_t FindLeaf(const Bbox &bbox) const;
+    void MarkDirty(uint32_t node);
+
+    const Scene &scene_;
+
+    std::unique_ptr<GlBuffer> camera_info_buffer_ = nullptr;
+    std::unique_ptr<GlProgram> node_cull_program_ = nullptr;
+    std::unique_ptr<GlProgram> init_buffer_program_ = nullptr;
+    std::unique_ptr<GlProgram> calc_args_program_ = nullptr;
+    std::unique_ptr<GlProgram> calc_expand_args_program_ = nullptr;
+    std::unique_ptr<GlProgram> expand_program_ = nullptr;
+    std::unique_ptr<GlProgram> update_program_ = nullptr;
+    std::unique_ptr<GlProgram> refit_program_ = nullptr;
+    std::unique_ptr<GlProgram> traverse_program_ = nullptr;
+    std::unique_ptr<GlProgram> gather_proxies_program_ = nullptr;
+    std::unique_ptr<GlProgram> sorted_draws_program_ = nullptr;
+    std::unique_ptr<GlProgram> gather_queue_program_ = nullptr;
+
+    // test the whole hierarchy in one dispatch instead of one dispatch per level
+    bool persistent_traversal_ = false;
+    uint32_t persistent_work_groups_ = 0;
+    // nodes with a proxy that cover fewer pixels along their longest side are drawn as their proxy
+    float hlod_max_pixels_ = 16.0f;
+
+    // a leaf spans its instances followed by its free slots, internal nodes span the slots of their leaves
+    std::vector<Node> nodes_;
+    std::vector<int> node_parents_;
+    std::vector<uint32_t> node_levels_;
+    std::vector<uint32_t> leaf_sizes_;
+    std::vector<Bbox> loose_bboxes_;
+    std::vector<bool> dirty_nodes_;
+    std::vector<uint32_t> slots_;
+    std::vector<uint32_t> instance_leaves_;
+    std::vector<uint32_t> instance_slots_;
+    std::vector<bool> has_proxy_;
+
+    // internal nodes and leaves are numbered separately on the GPU, ids of leaves have kLeafBit set.
+    // internal node 0 is a virtual root above nodes_[0].
+    std::vector<uint32_t> gpu_ids_;
+    uint32_t num_internal_nodes_ = 0;
+    uint32_t num_leaves_ = 0;
+
+    // internal levels tested from the virtual root down
+    uint32_t num_levels_ = 0;
+    std::unique_ptr<GlBuffer> dispatch_args_buffer_ = nullptr;
+    std::unique_ptr<GlBuffer> hierarchy_buffer_ = nullptr;
+    std::unique_ptr<GlBuffer> hierarchy_link_buffer_ = nullptr;
+    std::unique_ptr<GlBuffer> hierarchy_leaf_buffer_ = nullptr;
+    // exact bounds of internal nodes followed by the leaves, only read when refitting
+    std::unique_ptr<GlBuffer> node_bbox_buffer_ = nullptr;
+    std::unique_ptr<GlBuffer> io_nodes_buffer_[2];
+    std::unique_ptr<GlBuffer> visible_nodes_buffer_ = nullptr;
+    std::unique_ptr<GlBuffer> work_queue_buffer_ = nullptr;
+    std::unique_ptr<GlBuffer> hierarchy_instance_buffer_ = nullptr;
+    std::unique_ptr<GlBuffer> instance_bbox_buffer_ = nullptr;
+    std::unique_ptr<GlBuffer> update_params_buffer_ = nullptr;
+    std::unique_ptr<GlBuffer> instance_update_buffer_ = nullptr;
+    std::unique_ptr<GlBuffer> slot_update_buffer_ = nullptr;
+    std::unique_ptr<GlBuffer> refit_params_buffer_ = nullptr;
+    std::unique_ptr<GlBuffer> refit_nodes_buffer_ = nullptr;
+
+    // proxies of all nodes share one mesh, the index range of each internal node is empty if it has no proxy
+    uint32_t num_proxies_ = 0;
+    uint32_t num_proxy_indices_ = 0;
+    std::unique_ptr<GlBuffer> node_proxy_buffer_ = nullptr;
+    std::unique_ptr<GlBuffer> proxy_position_buffer_ = nullptr;
+    std::unique_ptr<GlBuffer> proxy_normal_buffer_ = nullptr;
+    std::unique_ptr<GlBuffer> proxy_index_buffer_ = nullptr;
+    std::unique_ptr<GlBuffer> proxy_nodes_buffer_ = nullptr;
+    std::unique_ptr<GlBuffer> proxy_draw_args_buffer_ = nullptr;
+    std::unique_ptr<GlBuffer> proxy_draw_index_buffer_ = nullptr;
+
+    std::vector<uint32_t> model_instances_count_;
+    std::unique_ptr<GlBuffer> transform_buffer_ = nullptr;
+    std::unique_ptr<GlBuffer> instance_model_buffer_ = nullptr;
+    std::unique_ptr<GlBuffer> model_min_pixel_area_buffer_ = nullptr;
+    std::unique_ptr<GlBuffer> model_lod_buffer_ = nullptr;
+    std::unique_ptr<GlBuffer> init_draw_args_buffer_ = nullptr;
+    std::unique_ptr<GlBuffer> draw_args_buffer_ = nullptr;
+    std::unique_ptr<GlBuffer> draw_list_buffer_ = nullptr;
+    bool front_to_back_ = false;
+    uint32_t draw_sort_key_bits_ = 0;
+    std::unique_ptr<RadixSort> draw_sort_ = nullptr;
+
+    std::unique_ptr<GlBuffer> stats_buffer_ = nullptr;
+    std::unique_ptr<GlReadbackBuffer> stats_readback_ = nullptr;
+
+    uint32_t num_drawn_instances_ = 0;
+    uint32_t num_tested_nodes_ = 0;
+    uint32_t num_contribution_culled_ = 0;
+    uint32_t num_drawn_triangles_ = 0;
+    uint32_t num_drawn_proxies_ = 0;
+};
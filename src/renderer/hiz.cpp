@@ -0,0 +1,90 @@
+#include "hiz.hpp"
+
+#include <cassert>
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include "rasterizer/utils.hpp"
+
+namespace {
+
+constexpr uint32_t kMaxHiZLevels = 16;
+
+// each work group reduces a 64x64 tile down to a single texel of level 5
+constexpr uint32_t kTileSize = 64;
+
+struct alignas(16) HiZInfo {
+    glm::ivec2 screen_size;
+    uint32_t num_levels;
+    uint32_t num_work_groups;
+    glm::ivec4 levels[kMaxHiZLevels];
+};
+
+}
+
+HiZBuffer::HiZBuffer() {
+    CreateComputeProgram(hiz_gen_program_, kShaderSourceDir / "hiz_gen.comp");
+
+    info_buffer_ = std::make_unique<GlBuffer>(sizeof(HiZInfo), GL_DYNAMIC_STORAGE_BIT);
+    uint32_t zero = 0;
+    counter_buffer_ = std::make_unique<GlBuffer>(sizeof(uint32_t), 0, &zero);
+}
+
+void HiZBuffer::Resize(uint32_t width, uint32_t height) {
+    width_ = width;
+    height_ = height;
+    num_work_groups_x_ = (width + kTileSize - 1) / kTileSize;
+    num_work_groups_y_ = (height + kTileSize - 1) / kTileSize;
+
+    HiZInfo info {
+        .screen_size = glm::ivec2(width, height),
+        .num_levels = 0,
+        .num_work_groups = num_work_groups_x_ * num_work_groups_y_,
+        .levels = {},
+    };
+
+    // level 0 sits at the origin, the other levels are stacked in a column to its right.
+    // each level reserves at least 2x2 texels so that a 2x2 gather never reads from another level.
+    glm::ivec2 size((width + 1) / 2, (height + 1) / 2);
+    glm::ivec2 offset(0, 0);
+    glm::ivec2 atlas_size(0, 0);
+    while (true) {
+        assert(info.num_levels < kMaxHiZLevels);
+        info.levels[info.num_levels++] = glm::ivec4(offset, size);
+        auto reserved_size = glm::max(size, glm::ivec2(2));
+        atlas_size = glm::max(atlas_size, offset + reserved_size);
+        if (size.x == 1 && size.y == 1) {
+            break;
+        }
+        if (info.num_levels == 1) {
+            offset.x = reserved_size.x;
+        } else {
+            offset.y += reserved_size.y;
+        }
+        size = (size + 1) / 2;
+    }
+    num_levels_ = info.num_levels;
+
+    hiz_texture_ = std::make_unique<GlTexture2D>(GL_RG32F, atlas_size.x, atlas_size.y, 1);
+    glNamedBufferSubData(info_buffer_->Id(), 0, sizeof(HiZInfo), &info);
+}
+
+void HiZBuffer::Generate(const GlTexture2D *depth_buffer) {
+    glUseProgram(hiz_gen_program_->Id());
+
+    glBindTextureUnit(0, depth_buffer->Id());
+    glBindImageTexture(1, hiz_texture_->Id(), 0, GL_FALSE, 0, GL_READ_WRITE, hiz_texture_->Format());
+    glBindBufferBase(GL_UNIFORM_BUFFER, 2, info_buffer_->Id());
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, counter_buffer_->Id());
+
+    glDispatchCompute(num_work_groups_x_, num_work_groups_y_, 1);
+    glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT | GL_TEXTURE_FETCH_BARRIER_BIT);
+
+    glUseProgram(0);
+}
+
+void HiZBuffer::Bind(uint32_t texture_unit, uint32_t info_binding) const {
+    glBindTextureUnit(texture_unit, hiz_texture_->Id());
+    glBindBufferBase(GL_UNIFORM_BUFFER, info_binding, info_buffer_->Id());
+}
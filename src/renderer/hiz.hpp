@@ -0,0 +1,35 @@
+#pragma once
+
+#include <memory>
+
+#include "glh/program.hpp"
+#include "glh/resource.hpp"
+
+// Min/max depth pyramid of a depth target, starting from half resolution.
+// All levels are packed into one atlas texture so that they can be built in a single dispatch.
+class HiZBuffer {
+public:
+    HiZBuffer();
+
+    void Resize(uint32_t width, uint32_t height);
+    uint32_t Width() const { return width_; }
+    uint32_t Height() const { return height_; }
+    uint32_t Levels() const { return num_levels_; }
+
+    void Generate(const GlTexture2D *depth_buffer);
+
+    void Bind(uint32_t texture_unit, uint32_t info_binding) const;
+
+private:
+    std::unique_ptr<GlProgram> hiz_gen_program_ = nullptr;
+
+    uint32_t width_ = 0;
+    uint32_t height_ = 0;
+    uint32_t num_levels_ = 0;
+    uint32_t num_work_groups_x_ = 0;
+    uint32_t num_work_groups_y_ = 0;
+
+    std::unique_ptr<GlTexture2D> hiz_texture_ = nullptr;
+    std::unique_ptr<GlBuffer> info_buffer_ = nullptr;
+    std::unique_ptr<GlBuffer> counter_buffer_ = nullptr;
+};
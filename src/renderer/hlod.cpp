@@ -0,0 +1,91 @@
+#include "hlod.hpp"
+
+#include <algorithm>
+#include <unordered_map>
+#include <unordered_set>
+
+void HlodMesh::Append(const HlodMesh &mesh) {
+    const auto vertex_offset = static_cast<uint32_t>(positions.size());
+    positions.insert(positions.end(), mesh.positions.begin(), mesh.positions.end());
+    normals.insert(normals.end(), mesh.normals.begin(), mesh.normals.end());
+    for (auto index : mesh.indices) {
+        indices.push_back(vertex_offset + index);
+    }
+}
+
+void HlodMesh::Append(const Model &model, const Model::Lod &lod, const glm::mat4 &transform) {
+    const glm::mat3 normal_transform = glm::transpose(glm::inverse(glm::mat3(transform)));
+    std::unordered_map<uint32_t, uint32_t> vertex_map;
+    for (uint32_t i = lod.first_index; i < lod.first_index + lod.num_indices; i++) {
+        const auto vertex = model.Indices()[i];
+        auto [it, inserted] = vertex_map.try_emplace(vertex, positions.size());
+        if (inserted) {
+            positions.push_back(glm::vec3(transform * glm::vec4(model.Positions()[vertex], 1.0f)));
+            normals.push_back(glm::normalize(normal_transform * model.Normals()[vertex]));
+        }
+        indices.push_back(it->second);
+    }
+}
+
+HlodMesh ClusterVertices(const HlodMesh &mesh, const Bbox &bbox, uint32_t resolution) {
+    const auto extent = bbox.pmax - bbox.pmin;
+    const float cell_size = std::max(std::max(extent.x, extent.y), extent.z) / resolution;
+    if (cell_size <= 0.0f) {
+        return mesh;
+    }
+
+    // a merged vertex sits at the average of its cell
+    HlodMesh result;
+    std::vector<uint32_t> counts;
+    std::vector<uint32_t> vertex_remap(mesh.positions.size());
+    std::unordered_map<uint32_t, uint32_t> cell_vertices;
+    for (size_t i = 0; i < mesh.positions.size(); i++) {
+        const auto cell = glm::clamp(glm::ivec3(glm::floor((mesh.positions[i] - bbox.pmin) / cell_size)),
+            glm::ivec3(0), glm::ivec3(resolution - 1));
+        const uint32_t key = (cell.z * resolution + cell.y) * resolution + cell.x;
+        auto [it, inserted] = cell_vertices.try_emplace(key, result.positions.size());
+        if (inserted) {
+            result.positions.push_back(glm::vec3(0.0f));
+            result.normals.push_back(glm::vec3(0.0f));
+            counts.push_back(0);
+        }
+        result.positions[it->second] += mesh.positions[i];
+        result.normals[it->second] += mesh.normals[i];
+        ++counts[it->second];
+        vertex_remap[i] = it->second;
+    }
+    for (size_t i = 0; i < result.positions.size(); i++) {
+        result.positions[i] /= static_cast<float>(counts[i]);
+    }
+
+    // surviving triangles also get merged if they end up on the same vertices
+    std::unordered_set<uint64_t> triangle_keys;
+    std::vector<glm::vec3> face_normals(result.positions.size(), glm::vec3(0.0f));
+    for (size_t i = 0; i < mesh.indices.size(); i += 3) {
+        uint32_t v[3] = { vertex_remap[mesh.indices[i]], vertex_remap[mesh.indices[i + 1]],
+            vertex_remap[mesh.indices[i + 2]] };
+        if (v[0] == v[1] || v[1] == v[2] || v[2] == v[0]) {
+            continue;
+        }
+        uint32_t sorted[3] = { v[0], v[1], v[2] };
+        std::sort(sorted, sorted + 3);
+        const uint64_t key = (static_cast<uint64_t>(sorted[0]) << 42) | (static_cast<uint64_t>(sorted[1]) << 21)
+            | sorted[2];
+        if (!triangle_keys.insert(key).second) {
+            continue;
+        }
+        result.indices.insert(result.indices.end(), { v[0], v[1], v[2] });
+        const auto n = glm::cross(result.positions[v[1]] - result.positions[v[0]],
+            result.positions[v[2]] - result.positions[v[0]]);
+        for (auto u : v) {
+            face_normals[u] += n;
+        }
+    }
+
+    // normals of the merged surface, the averaged input normals are kept where the faces cancel out
+    for (size_t i = 0; i < result.normals.size(); i++) {
+        const auto &n = glm::length(face_normals[i]) > 0.0f ? face_normals[i] : result.normals[i];
+        result.normals[i] = glm::length(n) > 0.0f ? glm::normalize(n) : glm::vec3(0.0f, 1.0f, 0.0f);
+    }
+    return result;
+}
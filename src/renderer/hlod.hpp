@@ -0,0 +1,23 @@
+#pragma once
+
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "scene/model.hpp"
+
+// merged geometry of several instances in world space, the proxy of a hierarchy node
+struct HlodMesh {
+    std::vector<glm::vec3> positions;
+    std::vector<glm::vec3> normals;
+    std::vector<uint32_t> indices;
+
+    void Append(const HlodMesh &mesh);
+    // appends the triangles of `lod` placed by `transform`
+    void Append(const Model &model, const Model::Lod &lod, const glm::mat4 &transform);
+};
+
+// simplifies `mesh` by merging all vertices in a cell of a grid with cubic cells and `resolution` cells along the
+// longest axis of `bbox`, triangles that collapse are dropped. unlike edge collapses this also merges separate
+// instances that are close to each other.
+HlodMesh ClusterVertices(const HlodMesh &mesh, const Bbox &bbox, uint32_t resolution);
@@ -0,0 +1,191 @@
+#include "impostor.hpp"
+
+#include <cassert>
+#include <chrono>
+#include <cmath>
+#include <iostream>
+
+#include <glad/glad.h>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include "rasterizer/utils.hpp"
+
+namespace {
+
+// views per side of the octahedral grid of a model
+constexpr uint32_t kImpostorGridSize = 8;
+// texels per side of a view, halved until the atlas fits in the maximum texture size
+constexpr uint32_t kImpostorTileSize = 64;
+constexpr uint32_t kMinImpostorTileSize = 8;
+
+struct alignas(16) GpuImpostorModel {
+    glm::vec3 center;
+    float radius;
+    glm::ivec2 atlas_offset;
+};
+
+struct alignas(16) GpuImpostorInstance {
+    glm::mat4 transform;
+    glm::mat4 inv_transform;
+    uint32_t model;
+};
+
+struct alignas(16) ImpostorParams {
+    glm::mat4 view_proj;
+    glm::mat4 inv_view_proj;
+    glm::vec4 camera_pos;
+    glm::uvec2 viewport_size;
+    uint32_t grid_size;
+    uint32_t tile_size;
+};
+
+// inverse of oct_encode() in impostor/draw.comp
+glm::vec3 OctDecode(const glm::vec2 &uv) {
+    const auto v = uv * 2.0f - 1.0f;
+    glm::vec3 dir(v.x, v.y, 1.0f - std::abs(v.x) - std::abs(v.y));
+    if (dir.z < 0.0f) {
+        dir.x = (1.0f - std::abs(v.y)) * (v.x >= 0.0f ? 1.0f : -1.0f);
+        dir.y = (1.0f - std::abs(v.x)) * (v.y >= 0.0f ? 1.0f : -1.0f);
+    }
+    return glm::normalize(dir);
+}
+
+GpuImpostorInstance MakeImpostorInstance(const Scene::Instance &inst) {
+    return GpuImpostorInstance {
+        .transform = inst.transform,
+        .inv_transform = glm::inverse(inst.transform),
+        .model = static_cast<uint32_t>(inst.model),
+    };
+}
+
+}
+
+ImpostorAtlas::ImpostorAtlas(const Scene &scene) : scene_(scene) {
+    CreateComputeProgram(draw_program_, kShaderSourceDir / "impostor/draw.comp");
+
+    std::vector<GpuImpostorInstance> instances;
+    scene.ForEachInstance([&](const Scene::Instance &inst, const Model &model) {
+        instances.push_back(MakeImpostorInstance(inst));
+    });
+    instance_buffer_ = std::make_unique<GlBuffer>(instances.size() * sizeof(GpuImpostorInstance),
+        GL_DYNAMIC_STORAGE_BIT, instances.data());
+    params_buffer_ = std::make_unique<GlBuffer>(sizeof(ImpostorParams), GL_DYNAMIC_STORAGE_BIT);
+}
+
+void ImpostorAtlas::UpdateInstances(const std::vector<uint32_t> &instances) {
+    for (auto inst_id : instances) {
+        const auto inst = MakeImpostorInstance(scene_.GetInstance(inst_id));
+        glNamedBufferSubData(instance_buffer_->Id(), inst_id * sizeof(GpuImpostorInstance), sizeof(inst), &inst);
+    }
+}
+
+void ImpostorAtlas::Bake() {
+    const auto start_time = std::chrono::steady_clock::now();
+
+    // the views of a model form a block of the atlas, blocks are laid out in a square grid
+    const auto num_models = static_cast<uint32_t>(scene_.ModelsCount());
+    const auto atlas_columns = static_cast<uint32_t>(std::ceil(std::sqrt(static_cast<float>(num_models))));
+    const auto atlas_rows = (num_models + atlas_columns - 1) / atlas_columns;
+    int max_texture_size = 0;
+    glGetIntegerv(GL_MAX_TEXTURE_SIZE, &max_texture_size);
+    assert(max_texture_size > 0);
+    const auto max_atlas_size = static_cast<uint32_t>(max_texture_size);
+    tile_size_ = kImpostorTileSize;
+    while (tile_size_ > kMinImpostorTileSize
+        && std::max(atlas_columns, atlas_rows) * kImpostorGridSize * tile_size_ > max_atlas_size) {
+        tile_size_ /= 2;
+    }
+    const auto block_size = kImpostorGridSize * tile_size_;
+    color_atlas_ = std::make_unique<GlTexture2D>(GL_RGBA8, atlas_columns * block_size, atlas_rows * block_size, 1);
+    depth_atlas_ = std::make_unique<GlTexture2D>(GL_R32F, atlas_columns * block_size, atlas_rows * block_size, 1);
+
+    // views are drawn by a rasterizer of their own, the alpha of the color marks the covered texels
+    Rasterizer rasterizer(tile_size_, tile_size_);
+    GlTexture2D color_target(GL_RGBA8, tile_size_, tile_size_, 1);
+    GlTexture2D depth_target(GL_R32F, tile_size_, tile_size_, 1);
+    rasterizer.SetViewport(tile_size_, tile_size_);
+    rasterizer.SetColorTarget(&color_target);
+    rasterizer.SetDepthTarget(&depth_target);
+    rasterizer.SetClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+    rasterizer.SetClearDepth(1.0f);
+    rasterizer.SetMatrixModel(glm::mat4(1.0f));
+    const auto &geometry = scene_.GetGeometryPool();
+    rasterizer.SetPositionBuffer(geometry.PositionBuffer());
+    rasterizer.SetNormalBuffer(geometry.NormalBuffer());
+    rasterizer.SetIndexBuffer(geometry.IndexBuffer());
+
+    std::vector<GpuImpostorModel> models(num_models);
+    for (uint32_t i = 0; i < num_models; i++) {
+        const auto &model = scene_.GetModel(i);
+        const auto &bbox = model.Bbox();
+        const auto &lod = model.Lods().front();
+        models[i].center = (bbox.pmin + bbox.pmax) * 0.5f;
+        models[i].radius = std::max(glm::length(bbox.pmax - bbox.pmin) * 0.5f, 1e-6f);
+        models[i].atlas_offset = glm::ivec2(i % atlas_columns, i / atlas_columns) * static_cast<int>(block_size);
+
+        // depth 0 and 1 of a view are at the front and the back of the bounding sphere
+        const auto radius = models[i].radius;
+        rasterizer.SetMatrixProj(glm::orthoZO(-radius, radius, -radius, radius, radius, radius * 3.0f));
+        for (uint32_t y = 0; y < kImpostorGridSize; y++) {
+            for (uint32_t x = 0; x < kImpostorGridSize; x++) {
+                const auto dir = OctDecode((glm::vec2(x, y) + 0.5f) / static_cast<float>(kImpostorGridSize));
+                const auto up = std::abs(dir.y) > 0.99f ? glm::vec3(0.0f, 0.0f, 1.0f) : glm::vec3(0.0f, 1.0f, 0.0f);
+                rasterizer.SetMatrixView(glm::lookAt(models[i].center + dir * radius * 2.0f, models[i].center, up));
+                rasterizer.ClearBuffers();
+                rasterizer.DrawIndexed(lod.num_indices, model.FirstIndex() + lod.first_index, model.VertexOffset());
+
+                glMemoryBarrier(GL_TEXTURE_UPDATE_BARRIER_BIT);
+                const auto offset = models[i].atlas_offset + glm::ivec2(x, y) * static_cast<int>(tile_size_);
+                glCopyImageSubData(color_target.Id(), GL_TEXTURE_2D, 0, 0, 0, 0, color_atlas_->Id(), GL_TEXTURE_2D, 0,
+                    offset.x, offset.y, 0, tile_size_, tile_size_, 1);
+                glCopyImageSubData(depth_target.Id(), GL_TEXTURE_2D, 0, 0, 0, 0, depth_atlas_->Id(), GL_TEXTURE_2D, 0,
+                    offset.x, offset.y, 0, tile_size_, tile_size_, 1);
+            }
+        }
+    }
+    model_buffer_ = std::make_unique<GlBuffer>(models.size() * sizeof(GpuImpostorModel), 0, models.data());
+
+    const std::chrono::duration<double, std::milli> bake_time = std::chrono::steady_clock::now() - start_time;
+    std::cout << "Impostors: " << num_models << " models, " << color_atlas_->Width() << "x" << color_atlas_->Height()
+        << " atlas, baked in " << bake_time.count() << " ms" << std::endl;
+}
+
+void ImpostorAtlas::Draw(Rasterizer &rasterizer, const GlBuffer *instances, const GlBuffer *dispatch_args) {
+    if (color_atlas_ == nullptr) {
+        Bake();
+    }
+
+    auto frame_buffer = rasterizer.GetColorTarget();
+    auto depth_buffer = rasterizer.GetDepthTarget();
+    const auto view_proj = rasterizer.GetMatrixProj() * rasterizer.GetMatrixView();
+    ImpostorParams params {
+        .view_proj = view_proj,
+        .inv_view_proj = glm::inverse(view_proj),
+        .camera_pos = glm::inverse(rasterizer.GetMatrixView())[3],
+        .viewport_size = glm::uvec2(depth_buffer->Width(), depth_buffer->Height()),
+        .grid_size = kImpostorGridSize,
+        .tile_size = tile_size_,
+    };
+    glNamedBufferSubData(params_buffer_->Id(), 0, sizeof(ImpostorParams), &params);
+
+    glUseProgram(draw_program_->Id());
+
+    glBindTextureUnit(0, color_atlas_->Id());
+    glBindTextureUnit(1, depth_atlas_->Id());
+    glBindImageTexture(2, frame_buffer->Id(), 0, GL_FALSE, 0, GL_WRITE_ONLY, frame_buffer->Format());
+    glBindImageTexture(3, depth_buffer->Id(), 0, GL_FALSE, 0, GL_READ_WRITE, GL_R32I);
+    uint32_t storage_buffers[] = {
+        model_buffer_->Id(),
+        instance_buffer_->Id(),
+        instances->Id(),
+    };
+    glBindBuffersBase(GL_SHADER_STORAGE_BUFFER, 4, 3, storage_buffers);
+    glBindBufferBase(GL_UNIFORM_BUFFER, 7, params_buffer_->Id());
+
+    glBindBuffer(GL_DISPATCH_INDIRECT_BUFFER, dispatch_args->Id());
+    glDispatchComputeIndirect(0);
+    glBindBuffer(GL_DISPATCH_INDIRECT_BUFFER, 0);
+    glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+
+    glUseProgram(0);
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <memory>
+#include <vector>
+
+#include "scene/scene.hpp"
+#include "rasterizer/rasterizer.hpp"
+
+// Octahedral impostors of the models of a scene. Each model is rendered by the rasterizer from a grid of
+// kImpostorGridSize^2 directions spread over the sphere by an octahedral mapping, and all views are packed into
+// a color and a depth atlas. The rasterizer has no programmable fragment stage, so impostors are drawn by a
+// compute pass that intersects the view rays with the nearest baked view and depth tests like the rasterizer.
+class ImpostorAtlas {
+public:
+    ImpostorAtlas(const Scene &scene);
+
+    // called after the transforms of `instances` are changed in the scene
+    void UpdateInstances(const std::vector<uint32_t> &instances);
+
+    // draws the instances listed in `instances` as impostors to the targets of `rasterizer` with its view and
+    // projection, their number is the first uint of the dispatch arguments `dispatch_args` so that both can be
+    // produced by a shader. the atlas is baked before the first draw
+    void Draw(Rasterizer &rasterizer, const GlBuffer *instances, const GlBuffer *dispatch_args);
+
+private:
+    void Bake();
+
+    const Scene &scene_;
+
+    std::unique_ptr<GlProgram> draw_program_ = nullptr;
+
+    uint32_t tile_size_ = 0;
+    std::unique_ptr<GlTexture2D> color_atlas_ = nullptr;
+    std::unique_ptr<GlTexture2D> depth_atlas_ = nullptr;
+    std::unique_ptr<GlBuffer> model_buffer_ = nullptr;
+
+    std::unique_ptr<GlBuffer> instance_buffer_ = nullptr;
+    std::unique_ptr<GlBuffer> params_buffer_ = nullptr;
+};
@@ -0,0 +1,23 @@
+#include "lod.hpp"
+
+namespace {
+
+struct GpuModelLods {
+    uint32_t num_lods;
+    float errors[Model::kMaxLods];
+};
+
+}
+
+std::unique_ptr<GlBuffer> CreateModelLodBuffer(const Scene &scene) {
+    std::vector<GpuModelLods> model_lods(scene.ModelsCount());
+    for (size_t i = 0; i < scene.ModelsCount(); i++) {
+        const auto &model = scene.GetModel(i);
+        const float extent = model.Bbox().Extent();
+        model_lods[i].num_lods = model.LodsCount();
+        for (size_t lod = 0; lod < model.LodsCount(); lod++) {
+            model_lods[i].errors[lod] = extent > 0.0f ? model.Lods()[lod].error / extent : 0.0f;
+        }
+    }
+    return std::make_unique<GlBuffer>(model_lods.size() * sizeof(GpuModelLods), 0, model_lods.data());
+}
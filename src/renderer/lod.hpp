@@ -0,0 +1,8 @@
+#pragma once
+
+#include <memory>
+
+#include "scene/scene.hpp"
+
+// lod errors of all models in the layout of lod.glsl
+std::unique_ptr<GlBuffer> CreateModelLodBuffer(const Scene &scene);
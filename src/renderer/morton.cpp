@@ -0,0 +1,216 @@
+#include "morton.hpp"
+
+#include <algorithm>
+#include <memory>
+#include <thread>
+
+#include <glad/glad.h>
+
+#include "glh/program.hpp"
+#include "glh/resource.hpp"
+#include "rasterizer/utils.hpp"
+
+namespace {
+
+constexpr uint32_t kRadixBits = 8;
+constexpr uint32_t kRadixBins = 1 << kRadixBits;
+constexpr uint32_t kMortonBits = kMortonBitsPerAxis * 3;
+
+// radix sort work groups handle one block of 256 keys each
+constexpr uint32_t kRadixBlockSize = 256;
+
+constexpr size_t kMinItemsPerThread = 4096;
+
+size_t NumThreads(size_t count) {
+    return std::min<size_t>(std::max(std::thread::hardware_concurrency(), 1u),
+        std::max<size_t>((count + kMinItemsPerThread - 1) / kMinItemsPerThread, 1));
+}
+
+// calls func(thread, begin, end) on NumThreads(count) contiguous chunks
+template <typename Func>
+void ParallelFor(size_t count, Func &&func) {
+    const size_t num_threads = NumThreads(count);
+    if (num_threads == 1) {
+        func(0, 0, count);
+        return;
+    }
+    std::vector<std::thread> threads;
+    const size_t chunk = (count + num_threads - 1) / num_threads;
+    for (size_t i = 0; i < num_threads; i++) {
+        threads.emplace_back(func, i, std::min(i * chunk, count), std::min((i + 1) * chunk, count));
+    }
+    for (auto &thread : threads) {
+        thread.join();
+    }
+}
+
+uint32_t ExpandBits(uint32_t v) {
+    v = (v | (v << 16)) & 0x030000ff;
+    v = (v | (v << 8)) & 0x0300f00f;
+    v = (v | (v << 4)) & 0x030c30c3;
+    v = (v | (v << 2)) & 0x09249249;
+    return v;
+}
+
+glm::vec3 InvExtent(const Bbox &bounds) {
+    auto extent = bounds.pmax - bounds.pmin;
+    return glm::vec3(
+        extent.x > 0.0f ? 1.0f / extent.x : 0.0f,
+        extent.y > 0.0f ? 1.0f / extent.y : 0.0f,
+        extent.z > 0.0f ? 1.0f / extent.z : 0.0f
+    );
+}
+
+struct alignas(16) MortonParams {
+    glm::vec4 bounds_min;
+    glm::vec4 inv_extent;
+    uint32_t count;
+};
+
+struct alignas(16) RadixParams {
+    uint32_t count;
+    uint32_t shift;
+    uint32_t num_blocks;
+};
+
+}
+
+void SortByMortonCode(const std::vector<glm::vec3> &points, const Bbox &bounds,
+    std::vector<uint32_t> &codes, std::vector<uint32_t> &ids) {
+    const size_t count = points.size();
+    const auto inv_extent = InvExtent(bounds);
+    const float scale = static_cast<float>(1 << kMortonBitsPerAxis);
+
+    codes.resize(count);
+    ids.resize(count);
+    ParallelFor(count, [&](size_t, size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++) {
+            auto q = glm::clamp(glm::uvec3((points[i] - bounds.pmin) * inv_extent * scale),
+                glm::uvec3(0), glm::uvec3((1 << kMortonBitsPerAxis) - 1));
+            codes[i] = ExpandBits(q.x) | (ExpandBits(q.y) << 1) | (ExpandBits(q.z) << 2);
+            ids[i] = i;
+        }
+    });
+
+    // LSD radix sort, each thread counts and scatters its own chunk so that the sort stays stable
+    const size_t num_threads = NumThreads(count);
+    std::vector<uint32_t> temp_codes(count);
+    std::vector<uint32_t> temp_ids(count);
+    std::vector<size_t> offsets(num_threads * kRadixBins);
+    for (uint32_t shift = 0; shift < kMortonBits; shift += kRadixBits) {
+        std::fill(offsets.begin(), offsets.end(), 0);
+        ParallelFor(count, [&](size_t thread, size_t begin, size_t end) {
+            for (size_t i = begin; i < end; i++) {
+                ++offsets[thread * kRadixBins + ((codes[i] >> shift) & (kRadixBins - 1))];
+            }
+        });
+        size_t sum = 0;
+        for (uint32_t bin = 0; bin < kRadixBins; bin++) {
+            for (size_t thread = 0; thread < num_threads; thread++) {
+                auto num = offsets[thread * kRadixBins + bin];
+                offsets[thread * kRadixBins + bin] = sum;
+                sum += num;
+            }
+        }
+        ParallelFor(count, [&](size_t thread, size_t begin, size_t end) {
+            for (size_t i = begin; i < end; i++) {
+                auto dst = offsets[thread * kRadixBins + ((codes[i] >> shift) & (kRadixBins - 1))]++;
+                temp_codes[dst] = codes[i];
+                temp_ids[dst] = ids[i];
+            }
+        });
+        std::swap(codes, temp_codes);
+        std::swap(ids, temp_ids);
+    }
+}
+
+void SortByMortonCodeGpu(const std::vector<glm::vec3> &points, const Bbox &bounds,
+    std::vector<uint32_t> &codes, std::vector<uint32_t> &ids) {
+    const uint32_t count = points.size();
+    const uint32_t num_blocks = (count + kRadixBlockSize - 1) / kRadixBlockSize;
+
+    std::unique_ptr<GlProgram> codes_program;
+    std::unique_ptr<GlProgram> histogram_program;
+    std::unique_ptr<GlProgram> scan_program;
+    std::unique_ptr<GlProgram> scatter_program;
+    CreateComputeProgram(codes_program, kShaderSourceDir / "morton/codes.comp");
+    CreateComputeProgram(histogram_program, kShaderSourceDir / "morton/radix_histogram.comp");
+    CreateComputeProgram(scan_program, kShaderSourceDir / "morton/radix_scan.comp");
+    CreateComputeProgram(scatter_program, kShaderSourceDir / "morton/radix_scatter.comp");
+
+    std::vector<glm::vec4> points_data(count);
+    std::transform(points.begin(), points.end(), points_data.begin(), [](const glm::vec3 &p) {
+        return glm::vec4(p, 1.0f);
+    });
+    MortonParams morton_params {
+        .bounds_min = glm::vec4(bounds.pmin, 0.0f),
+        .inv_extent = glm::vec4(InvExtent(bounds), 0.0f),
+        .count = count,
+    };
+    auto points_buffer = std::make_unique<GlBuffer>(count * sizeof(glm::vec4), 0, points_data.data());
+    auto morton_params_buffer = std::make_unique<GlBuffer>(sizeof(MortonParams), 0, &morton_params);
+    std::unique_ptr<GlBuffer> key_buffers[2];
+    std::unique_ptr<GlBuffer> value_buffers[2];
+    for (size_t i = 0; i < 2; i++) {
+        key_buffers[i] = std::make_unique<GlBuffer>(count * sizeof(uint32_t));
+        value_buffers[i] = std::make_unique<GlBuffer>(count * sizeof(uint32_t));
+    }
+    auto histogram_buffer = std::make_unique<GlBuffer>(num_blocks * kRadixBins * sizeof(uint32_t));
+    auto radix_params_buffer = std::make_unique<GlBuffer>(sizeof(RadixParams), GL_DYNAMIC_STORAGE_BIT);
+
+    glUseProgram(codes_program->Id());
+    glBindBufferBase(GL_UNIFORM_BUFFER, 0, morton_params_buffer->Id());
+    uint32_t codes_buffers[] = {
+        points_buffer->Id(),
+        key_buffers[0]->Id(),
+        value_buffers[0]->Id(),
+    };
+    glBindBuffersBase(GL_SHADER_STORAGE_BUFFER, 1, 3, codes_buffers);
+    glDispatchCompute(num_blocks, 1, 1);
+    glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+    size_t curr = 0;
+    for (uint32_t shift = 0; shift < kMortonBits; shift += kRadixBits) {
+        RadixParams radix_params {
+            .count = count,
+            .shift = shift,
+            .num_blocks = num_blocks,
+        };
+        glNamedBufferSubData(radix_params_buffer->Id(), 0, sizeof(RadixParams), &radix_params);
+        glBindBufferBase(GL_UNIFORM_BUFFER, 0, radix_params_buffer->Id());
+
+        glUseProgram(histogram_program->Id());
+        uint32_t histogram_buffers[] = {
+            key_buffers[curr]->Id(),
+            histogram_buffer->Id(),
+        };
+        glBindBuffersBase(GL_SHADER_STORAGE_BUFFER, 1, 2, histogram_buffers);
+        glDispatchCompute(num_blocks, 1, 1);
+        glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+        glUseProgram(scan_program->Id());
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, histogram_buffer->Id());
+        glDispatchCompute(1, 1, 1);
+        glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+        glUseProgram(scatter_program->Id());
+        uint32_t scatter_buffers[] = {
+            key_buffers[curr]->Id(),
+            value_buffers[curr]->Id(),
+            histogram_buffer->Id(),
+            key_buffers[curr ^ 1]->Id(),
+            value_buffers[curr ^ 1]->Id(),
+        };
+        glBindBuffersBase(GL_SHADER_STORAGE_BUFFER, 1, 5, scatter_buffers);
+        glDispatchCompute(num_blocks, 1, 1);
+        glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT | GL_BUFFER_UPDATE_BARRIER_BIT);
+
+        curr ^= 1;
+    }
+    glUseProgram(0);
+
+    codes.resize(count);
+    ids.resize(count);
+    glGetNamedBufferSubData(key_buffers[curr]->Id(), 0, count * sizeof(uint32_t), codes.data());
+    glGetNamedBufferSubData(value_buffers[curr]->Id(), 0, count * sizeof(uint32_t), ids.data());
+}
@@ -0,0 +1,17 @@
+#pragma once
+
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "scene/bbox.hpp"
+
+inline constexpr uint32_t kMortonBitsPerAxis = 10;
+
+// Computes the 30 bit morton codes of `points` quantized in `bounds` (x in the lowest bit of each triple)
+// and sorts them in ascending order, together with the point indices.
+// The GPU version runs the same radix sort in compute shaders and reads the result back.
+void SortByMortonCode(const std::vector<glm::vec3> &points, const Bbox &bounds,
+    std::vector<uint32_t> &codes, std::vector<uint32_t> &ids);
+void SortByMortonCodeGpu(const std::vector<glm::vec3> &points, const Bbox &bounds,
+    std::vector<uint32_t> &codes, std::vector<uint32_t> &ids);
@@ -0,0 +1,105 @@
+#include "occluder_prepass.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+#include <imgui.h>
+
+namespace {
+
+constexpr int kMaxOccluders = 256;
+
+struct OccluderCandidate {
+    float area;
+    float depth;
+    uint32_t instance;
+};
+
+// same as project_bbox() in bounds.glsl, returns false if the box is outside the view frustum
+bool ProjectBbox(const glm::mat4 &view_proj, const Bbox &bbox, glm::vec2 &uv_min, glm::vec2 &uv_max,
+    float &depth_min) {
+    const auto center = view_proj * glm::vec4((bbox.pmin + bbox.pmax) * 0.5f, 1.0f);
+    const auto extent = (bbox.pmax - bbox.pmin) * 0.5f;
+    const auto ex = view_proj[0] * extent.x;
+    const auto ey = view_proj[1] * extent.y;
+    const auto ez = view_proj[2] * extent.z;
+
+    const float w_radius = std::abs(ex.w) + std::abs(ey.w) + std::abs(ez.w);
+    if (center.w + w_radius <= 0.0f) {
+        return false;
+    }
+    if (center.w - w_radius <= 0.0f) {
+        uv_min = glm::vec2(0.0f);
+        uv_max = glm::vec2(1.0f);
+        depth_min = -1.0f;
+        return true;
+    }
+
+    glm::vec3 ndc_min(1e30f);
+    glm::vec3 ndc_max(-1e30f);
+    for (uint32_t i = 0; i < 8; i++) {
+        const auto homo = center + ((i & 1) == 0 ? -ex : ex) + ((i & 2) == 0 ? -ey : ey) + ((i & 4) == 0 ? -ez : ez);
+        const auto ndc = glm::vec3(homo) / homo.w;
+        ndc_min = glm::min(ndc_min, ndc);
+        ndc_max = glm::max(ndc_max, ndc);
+    }
+    uv_min = glm::vec2(ndc_min.x * 0.5f + 0.5f, 0.5f - ndc_max.y * 0.5f);
+    uv_max = glm::vec2(ndc_max.x * 0.5f + 0.5f, 0.5f - ndc_min.y * 0.5f);
+    depth_min = ndc_min.z;
+
+    return glm::all(glm::lessThan(uv_min, glm::vec2(1.0f))) && glm::all(glm::greaterThan(uv_max, glm::vec2(0.0f)))
+        && ndc_max.z >= -1.0f && ndc_min.z <= 1.0f;
+}
+
+}
+
+OccluderPrepass::OccluderPrepass(const Scene &scene) : scene_(scene) {}
+
+void OccluderPrepass::Render(Rasterizer &rasterizer, HiZBuffer &hiz_buffer) {
+    auto depth_buffer = rasterizer.GetDepthTarget();
+    SelectOccluders(rasterizer.GetMatrixProj() * rasterizer.GetMatrixView(), depth_buffer->Width(),
+        depth_buffer->Height());
+
+    const auto &geometry = scene_.GetGeometryPool();
+    rasterizer.SetPositionBuffer(geometry.PositionBuffer());
+    rasterizer.SetNormalBuffer(geometry.NormalBuffer());
+    rasterizer.SetIndexBuffer(geometry.IndexBuffer());
+    for (auto inst_id : occluders_) {
+        const auto &inst = scene_.GetInstance(inst_id);
+        const auto &model = scene_.GetModel(inst.model);
+        rasterizer.SetMatrixModel(inst.transform);
+        rasterizer.DrawIndexed(model.IndicesCount(), model.FirstIndex(), model.VertexOffset());
+    }
+    hiz_buffer.Generate(depth_buffer);
+}
+
+void OccluderPrepass::DrawUi() {
+    ImGui::Text("Occluders: %d", static_cast<uint32_t>(occluders_.size()));
+    ImGui::SliderInt("Max occluders", &max_occluders_, 0, kMaxOccluders);
+    ImGui::Checkbox("Occluder prepass every frame", &every_frame_);
+}
+
+void OccluderPrepass::SelectOccluders(const glm::mat4 &view_proj, uint32_t width, uint32_t height) {
+    std::vector<OccluderCandidate> candidates;
+    for (uint32_t i = 0; i < scene_.InstancesCount(); i++) {
+        glm::vec2 uv_min;
+        glm::vec2 uv_max;
+        float depth_min;
+        if (!scene_.GetInstance(i).alive || !ProjectBbox(view_proj, scene_.GetInstance(i).bbox, uv_min, uv_max, depth_min)) {
+            continue;
+        }
+        const auto size = (glm::clamp(uv_max, 0.0f, 1.0f) - glm::clamp(uv_min, 0.0f, 1.0f))
+            * glm::vec2(width, height);
+        candidates.push_back(OccluderCandidate { size.x * size.y, depth_min, i });
+    }
+
+    const auto num_occluders = std::min<size_t>(max_occluders_, candidates.size());
+    std::partial_sort(candidates.begin(), candidates.begin() + num_occluders, candidates.end(),
+        [](const OccluderCandidate &a, const OccluderCandidate &b) {
+            return a.area != b.area ? a.area > b.area : a.depth < b.depth;
+        });
+    occluders_.resize(num_occluders);
+    for (size_t i = 0; i < num_occluders; i++) {
+        occluders_[i] = candidates[i].instance;
+    }
+}
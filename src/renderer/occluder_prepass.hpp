@@ -0,0 +1,34 @@
+#pragma once
+
+#include <vector>
+
+#include "scene/scene.hpp"
+#include "rasterizer/rasterizer.hpp"
+#include "hiz.hpp"
+
+// Draws the instances with the largest projected area before culling and builds the Hi-Z buffer from them,
+// so that culling works without the depth of the previous frame, e.g. in the first frame after a resize.
+// Running it every frame also keeps large disocclusions from being culled by stale depth.
+class OccluderPrepass {
+public:
+    OccluderPrepass(const Scene &scene);
+
+    // the occluders are drawn with color as well, as the depth test of the rasterizer rejects equal depth
+    // and they would stay blank when drawn again by the main pass
+    void Render(Rasterizer &rasterizer, HiZBuffer &hiz_buffer);
+
+    bool EveryFrame() const { return every_frame_; }
+
+    void DrawUi();
+
+private:
+    // ranked by projected area, ties are broken by the nearest depth
+    void SelectOccluders(const glm::mat4 &view_proj, uint32_t width, uint32_t height);
+
+    const Scene &scene_;
+
+    int max_occluders_ = 16;
+    bool every_frame_ = false;
+
+    std::vector<uint32_t> occluders_;
+};
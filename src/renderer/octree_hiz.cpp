@@ -1,66 +1,46 @@
 #include "octree_hiz.hpp"
 
 #include <algorithm>
+#include <chrono>
+#include <iostream>
 #include <stack>
 
 #include <glad/glad.h>
 #include <imgui.h>
 
 #include "rasterizer/utils.hpp"
+#include "morton.hpp"
 
 namespace {
 
 constexpr uint32_t kOctreeLeafSize = 1;
 constexpr float kOctreeLeafExtent = 1.0f;
 
-struct CameraInfo {
-    glm::mat4 view;
-    glm::mat4 proj;
-};
+// sorting the morton codes is moved to the GPU for scenes with at least this many instances
+constexpr uint32_t kGpuOctreeBuildMinInstances = 1 << 16;
 
 }
 
 OctreeHiZRenderer::OctreeHiZRenderer(Rasterizer &rasterizer, const Scene &scene) : Renderer(rasterizer, scene) {
+    culler_ = std::make_unique<HierarchyCuller>(scene);
     ConstructOctree();
 
-    CreateComputeProgram(hiz_gen_program_, kShaderSourceDir / "hiz_gen.comp");
-    CreateComputeProgram(node_cull_program_, kShaderSourceDir / "octree_hiz/node_test.comp");
-    CreateComputeProgram(init_buffer_program_, kShaderSourceDir / "octree_hiz/init_buffer.comp");
-    CreateComputeProgram(calc_args_program_, kShaderSourceDir / "octree_hiz/calc_args.comp");
-
-    camera_info_buffer_ = std::make_unique<GlBuffer>(sizeof(CameraInfo), GL_DYNAMIC_STORAGE_BIT);
-
-    dispatch_args_buffer_ = std::make_unique<GlBuffer>(sizeof(uint32_t) * 3);
+    hiz_buffer_ = std::make_unique<HiZBuffer>();
+    occluder_prepass_ = std::make_unique<OccluderPrepass>(scene);
 }
 
 void OctreeHiZRenderer::RenderScene() {
     auto depth_buffer = rasterizer_.GetDepthTarget();
-    bool can_do_cull = true;
-    if (!prev_depth_ || prev_depth_->Width() != depth_buffer->Width()
-        || prev_depth_->Height() != depth_buffer->Height()) {
-        prev_depth_ = std::make_unique<GlTexture2D>(depth_buffer->Format(), depth_buffer->Width(),
-            depth_buffer->Height(), 0);
-        can_do_cull = false;
+    bool has_prev_depth = true;
+    if (hiz_buffer_->Width() != depth_buffer->Width() || hiz_buffer_->Height() != depth_buffer->Height()) {
+        hiz_buffer_->Resize(depth_buffer->Width(), depth_buffer->Height());
+        has_prev_depth = false;
     }
-
-    if (!can_do_cull) {
-        scene_.ForEachInstance([this](const Scene::Instance &inst, const Model &model) {
-            rasterizer_.SetMatrixModel(inst.transform);
-            rasterizer_.SetPositionBuffer(model.PositionBuffer());
-            rasterizer_.SetNormalBuffer(model.NormalBuffer());
-            rasterizer_.SetIndexBuffer(model.IndexBuffer());
-            rasterizer_.DrawIndexed(model.IndicesCount());
-        });
-        GenerateHiZ();
-        return;
+    // without depth of the previous frame, the Hi-Z buffer is built from the occluders of this frame
+    if (!has_prev_depth || occluder_prepass_->EveryFrame()) {
+        occluder_prepass_->Render(rasterizer_, *hiz_buffer_);
     }
 
-    CameraInfo camera {
-        .view = rasterizer_.GetMatrixView(),
-        .proj = rasterizer_.GetMatrixProj(),
-    };
-    glNamedBufferSubData(camera_info_buffer_->Id(), 0, sizeof(CameraInfo), &camera);
-
 #if 0
     std::vector<bool> drawn_flags(scene_.InstancesCount(), false);
     num_drawn_instances_ = 0;
@@ -80,7 +60,7 @@ void OctreeHiZRenderer::RenderScene() {
                     rasterizer_.SetPositionBuffer(model.PositionBuffer());
                     rasterizer_.SetNormalBuffer(model.NormalBuffer());
                     rasterizer_.SetIndexBuffer(model.IndexBuffer());
-                    rasterizer_.DrawIndexed(model.IndicesCount());
+                    rasterizer_.DrawIndexed(model.IndicesCount(), model.FirstIndex(), model.VertexOffset());
                     drawn_flags[inst_id] = true;
                     ++num_drawn_instances_;
                 }
@@ -93,7 +73,7 @@ void OctreeHiZRenderer::RenderScene() {
         cull_result_buffer_->Unmap();
 
         glUseProgram(bbox_cull_program_->Id());
-        glBindTextureUnit(0, prev_depth_->Id());
+        hiz_buffer_->Bind(0, 3);
         glBindBufferBase(GL_UNIFORM_BUFFER, 1, u->bbox_buffer->Id());
         glBindBufferBase(GL_UNIFORM_BUFFER, 2, camera_info_buffer_->Id());
         glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, cull_result_buffer_->Id());
@@ -111,172 +91,128 @@ void OctreeHiZRenderer::RenderScene() {
         cull_result_buffer_->Unmap();
     }
 #else
-    size_t curr_in_buffer = 0;
-
-    glUseProgram(init_buffer_program_->Id());
-    uint32_t init_buffers[] = {
-        io_nodes_buffer_[curr_in_buffer]->Id(),
-        visible_nodes_buffer_->Id(),
-    };
-    glBindBuffersBase(GL_SHADER_STORAGE_BUFFER, 0, 2, init_buffers);
-    glDispatchCompute(1, 1, 1);
-    glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
-
-    glBindBuffer(GL_DISPATCH_INDIRECT_BUFFER, dispatch_args_buffer_->Id());
-    for (uint32_t i = 0; i <= octree_max_level_; i++) {
-        glUseProgram(calc_args_program_->Id());
-        uint32_t calc_args_buffers[] = {
-            io_nodes_buffer_[curr_in_buffer]->Id(),
-            io_nodes_buffer_[curr_in_buffer ^ 1]->Id(),
-            dispatch_args_buffer_->Id(),
-        };
-        glBindBuffersBase(GL_SHADER_STORAGE_BUFFER, 0, 3, calc_args_buffers);
-        glDispatchCompute(1, 1, 1);
-        glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT | GL_COMMAND_BARRIER_BIT);
-
-        glUseProgram(node_cull_program_->Id());
-        glBindTextureUnit(0, prev_depth_->Id());
-        glBindBufferBase(GL_UNIFORM_BUFFER, 1, camera_info_buffer_->Id());
-        uint32_t cull_buffers[] = {
-            octree_buffer_->Id(),
-            io_nodes_buffer_[curr_in_buffer]->Id(),
-            io_nodes_buffer_[curr_in_buffer ^ 1]->Id(),
-            visible_nodes_buffer_->Id(),
-        };
-        glBindBuffersBase(GL_SHADER_STORAGE_BUFFER, 2, 4, cull_buffers);
-        glDispatchComputeIndirect(0);
-        glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
-        
-        curr_in_buffer ^= 1;
-    }
-    glUseProgram(0);
-    glBindBuffer(GL_DISPATCH_INDIRECT_BUFFER, 0);
-
-    auto p_visible_buffer = visible_nodes_buffer_->TypedMap<uint32_t>();
-    std::vector<uint32_t> visible_nodes(p_visible_buffer[0]);
-    std::copy_n(p_visible_buffer + 1, visible_nodes.size(), visible_nodes.data());
-    visible_nodes_buffer_->Unmap();
-
-    std::vector<bool> drawn_flags(scene_.InstancesCount(), false);
-    num_drawn_instances_ = 0;
-    for (auto node_id : visible_nodes) {
-        for (auto inst_id : octree_nodes_[node_id].instances) {
-            if (!drawn_flags[inst_id]) {
-                const auto &inst = scene_.GetInstance(inst_id);
-                const auto &model = scene_.GetModel(inst.model);
-                rasterizer_.SetMatrixModel(inst.transform);
-                rasterizer_.SetPositionBuffer(model.PositionBuffer());
-                rasterizer_.SetNormalBuffer(model.NormalBuffer());
-                rasterizer_.SetIndexBuffer(model.IndexBuffer());
-                rasterizer_.DrawIndexed(model.IndicesCount());
-                drawn_flags[inst_id] = true;
-                ++num_drawn_instances_;
-            }
-        }
-    }
+    culler_->Cull(*hiz_buffer_, rasterizer_.GetMatrixProj() * rasterizer_.GetMatrixView(), contribution_cull_scale_,
+        LodPixelScale(), max_lod_error_, front_to_back_);
+    culler_->Draw(rasterizer_);
+    num_drawn_instances_ = culler_->NumDrawnInstances();
 #endif
 
-    GenerateHiZ();
+    hiz_buffer_->Generate(depth_buffer);
 }
 
 void OctreeHiZRenderer::DrawUi() {
-    ImGui::Text("Culling: %d / %d", num_drawn_instances_, static_cast<uint32_t>(scene_.InstancesCount()));
+    if (culler_->PollStats()) {
+        num_drawn_instances_ = culler_->NumDrawnInstances();
+    }
+    ImGui::Text("Culling: %d / %d", num_drawn_instances_, static_cast<uint32_t>(scene_.AliveInstancesCount()));
+    culler_->DrawUi();
+    occluder_prepass_->DrawUi();
 }
 
-void OctreeHiZRenderer::ConstructOctree() {
-    OctreeNode root(scene_.Bbox());
-    root.instances.resize(scene_.InstancesCount());
-    for (size_t i = 0; i < scene_.InstancesCount(); i++) {
-        root.instances[i] = i;
+void OctreeHiZRenderer::UpdateInstances(const std::vector<uint32_t> &instances) {
+    if (!culler_->UpdateInstances(instances)) {
+        ConstructOctree();
     }
-    octree_nodes_.push_back(std::move(root));
-    octree_max_level_ = 0;
+}
 
-    std::stack<uint32_t> stack;
-    stack.push(0);
-    while (!stack.empty()) {
-        auto u = stack.top();
-        stack.pop();
+void OctreeHiZRenderer::ConstructOctree() {
+    const auto start_time = std::chrono::steady_clock::now();
+
+    // free slots of the scene are left out until instances are added to them
+    std::vector<uint32_t> alive_instances;
+    std::vector<glm::vec3> centroids;
+    for (uint32_t i = 0; i < scene_.InstancesCount(); i++) {
+        const auto &inst = scene_.GetInstance(i);
+        if (inst.alive) {
+            alive_instances.push_back(i);
+            centroids.push_back(inst.bbox.Centroid());
+        }
+    }
+    const uint32_t num_instances = alive_instances.size();
+    const bool build_on_gpu = num_instances >= kGpuOctreeBuildMinInstances;
+    std::vector<uint32_t> codes;
+    std::vector<uint32_t> sorted_instances;
+    if (build_on_gpu) {
+        SortByMortonCodeGpu(centroids, scene_.Bbox(), codes, sorted_instances);
+    } else {
+        SortByMortonCode(centroids, scene_.Bbox(), codes, sorted_instances);
+    }
+    for (auto &inst_id : sorted_instances) {
+        inst_id = alive_instances[inst_id];
+    }
 
-        if (octree_nodes_[u].instances.size() <= kOctreeLeafSize
-            || octree_nodes_[u].bbox.Extent() <= kOctreeLeafExtent) {
+    // every instance belongs to the cell of its centroid, so a node at level l is the range of sorted instances
+    // sharing the first l octants of their morton codes. nodes are emitted in breadth first order.
+    octree_nodes_.clear();
+    octree_nodes_.push_back(OctreeNode(scene_.Bbox(), 0, num_instances, 0));
+    octree_max_level_ = 0;
+    for (size_t u = 0; u < octree_nodes_.size(); u++) {
+        const OctreeNode node = octree_nodes_[u];
+        if (node.num_instances <= kOctreeLeafSize || node.bbox.Extent() <= kOctreeLeafExtent
+            || node.level == kMortonBitsPerAxis) {
             continue;
         }
 
-        auto u_pmin = octree_nodes_[u].bbox.pmin;
-        auto delta = (octree_nodes_[u].bbox.pmax - octree_nodes_[u].bbox.pmin) * 0.5f;
-        Bbox bboxes[8];
-        for (size_t i = 0; i < 8; i++) {
-            auto c_pmin = u_pmin + glm::vec3(
-                (i & 1) == 0 ? 0.0 : delta.x,
-                (i & 2) == 0 ? 0.0 : delta.y,
-                (i & 4) == 0 ? 0.0 : delta.z
-            );
-            Bbox bbox1 { c_pmin, c_pmin + delta };
-            Bbox bbox2 {};
-            bbox2.Empty();
-            OctreeNode c(bbox1);
-            c.level = octree_nodes_[u].level + 1;
-            octree_max_level_ = std::max(octree_max_level_, c.level);
-            for (auto inst_id : octree_nodes_[u].instances) {
-                const auto &inst_bbox = scene_.GetInstance(inst_id).bbox;
-                if (c.bbox.IntersectWith(inst_bbox)) {
-                    c.instances.push_back(inst_id);
-                    bbox2.Merge(scene_.GetInstance(inst_id).bbox);
+        const uint32_t shift = (kMortonBitsPerAxis - 1 - node.level) * 3;
+        const auto delta = (node.bbox.pmax - node.bbox.pmin) * 0.5f;
+        auto begin = codes.begin() + node.first_instance;
+        const auto end = begin + node.num_instances;
+        for (uint32_t i = 0; i < 8; i++) {
+            auto child_end = std::upper_bound(begin, end, i, [shift](uint32_t octant, uint32_t code) {
+                return octant < ((code >> shift) & 7);
+            });
+            if (child_end != begin) {
+                auto c_pmin = node.bbox.pmin + glm::vec3(
+                    (i & 1) == 0 ? 0.0 : delta.x,
+                    (i & 2) == 0 ? 0.0 : delta.y,
+                    (i & 4) == 0 ? 0.0 : delta.z
+                );
+                octree_nodes_[u].ch[i] = octree_nodes_.size();
+                octree_nodes_.push_back(OctreeNode(Bbox { c_pmin, c_pmin + delta },
+                    begin - codes.begin(), child_end - begin, node.level + 1));
+                octree_max_level_ = node.level + 1;
+            }
+            begin = child_end;
+        }
+    }
+
+    // replace the cells with the bounds of the contained instances, children always come after their parent
+    for (size_t u = octree_nodes_.size(); u-- > 0;) {
+        auto &node = octree_nodes_[u];
+        node.bbox.Empty();
+        if (node.IsLeaf()) {
+            for (uint32_t i = 0; i < node.num_instances; i++) {
+                node.bbox.Merge(scene_.GetInstance(sorted_instances[node.first_instance + i]).bbox);
+            }
+        } else {
+            for (auto c : node.ch) {
+                if (c >= 0) {
+                    node.bbox.Merge(octree_nodes_[c].bbox);
                 }
             }
-            c.bbox.Intersect(bbox2);
-            uint32_t c_id = octree_nodes_.size();
-            octree_nodes_[u].ch[i] = c_id;
-            octree_nodes_.push_back(c);
-            stack.push(c_id);
-            bboxes[i] = bbox1;
         }
     }
 
-    struct GpuOctreeNode {
-        int ch[8];
-        Bbox bbox;
-        float _pad0;
-        float _pad1;
-    };
-    std::vector<GpuOctreeNode> gpu_octree(octree_nodes_.size());
+    std::vector<HierarchyCuller::Node> gpu_octree(octree_nodes_.size());
     for (size_t i = 0; i < octree_nodes_.size(); i++) {
-        gpu_octree[i].bbox = octree_nodes_[i].bbox;
         std::copy_n(octree_nodes_[i].ch, 8, gpu_octree[i].ch);
+        gpu_octree[i].bbox = octree_nodes_[i].bbox;
+        gpu_octree[i].first_instance = octree_nodes_[i].first_instance;
+        gpu_octree[i].num_instances = octree_nodes_[i].num_instances;
     }
-    octree_buffer_ = std::make_unique<GlBuffer>(octree_nodes_.size() * sizeof(GpuOctreeNode), 0, gpu_octree.data());
-    auto nodes_buffer_size = octree_nodes_.size() * sizeof(uint32_t);
-    io_nodes_buffer_[0] = std::make_unique<GlBuffer>(nodes_buffer_size);
-    io_nodes_buffer_[1] = std::make_unique<GlBuffer>(nodes_buffer_size);
-    visible_nodes_buffer_ = std::make_unique<GlBuffer>(nodes_buffer_size, GL_MAP_READ_BIT);
+    culler_->SetHierarchy(gpu_octree, sorted_instances);
+    culler_->BakeProxies();
+
+    const std::chrono::duration<double, std::milli> build_time = std::chrono::steady_clock::now() - start_time;
+    std::cout << "Octree: " << octree_nodes_.size() << " nodes, " << octree_max_level_ + 1 << " levels, built on the "
+        << (build_on_gpu ? "GPU" : "CPU") << " in " << build_time.count() << " ms\n";
 }
 
-OctreeHiZRenderer::OctreeNode::OctreeNode(Bbox bbox) : bbox(bbox) {
-    instances = {},
+OctreeHiZRenderer::OctreeNode::OctreeNode(Bbox bbox, uint32_t first_instance, uint32_t num_instances,
+    uint32_t level) : bbox(bbox), first_instance(first_instance), num_instances(num_instances), level(level) {
     std::fill_n(ch, 8, -1);
-    level = 0;
 }
 
-void OctreeHiZRenderer::GenerateHiZ() {
-    glCopyImageSubData(rasterizer_.GetDepthTarget()->Id(), GL_TEXTURE_2D, 0, 0, 0, 0,
-        prev_depth_->Id(), GL_TEXTURE_2D, 0, 0, 0, 0, prev_depth_->Width(), prev_depth_->Height(), 1);
-
-    glUseProgram(hiz_gen_program_->Id());
-
-    uint32_t level = 0;
-    uint32_t width = prev_depth_->Width();
-    uint32_t height = prev_depth_->Height();
-    while (width > 1 || height > 1) {
-        ++level;
-        width = width == 1 ? 1 : width / 2;
-        height = height == 1 ? 1 : height / 2;
-
-        glBindImageTexture(0, prev_depth_->Id(), level - 1, GL_FALSE, 0, GL_READ_ONLY, GL_R32I);
-        glBindImageTexture(1, prev_depth_->Id(), level, GL_FALSE, 0, GL_WRITE_ONLY, GL_R32I);
-        glDispatchCompute((width + 15) / 16, (height + 15) / 16, 1);
-        glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
-    }
-
-    glUseProgram(0);
+bool OctreeHiZRenderer::OctreeNode::IsLeaf() const {
+    return std::all_of(ch, ch + 8, [](int c) { return c < 0; });
 }
@@ -1,6 +1,9 @@
 #pragma once
 
 #include "renderer.hpp"
+#include "hiz.hpp"
+#include "occluder_prepass.hpp"
+#include "hierarchy_cull.hpp"
 
 class OctreeHiZRenderer final : public Renderer {
 public:
@@ -10,36 +13,32 @@ public:
 
     void DrawUi() override;
 
+    void UpdateInstances(const std::vector<uint32_t> &instances) override;
+
 private:
     void ConstructOctree();
 
-    void GenerateHiZ();
-
-    std::unique_ptr<GlTexture2D> prev_depth_ = nullptr;
-    std::unique_ptr<GlProgram> hiz_gen_program_ = nullptr;
+    std::unique_ptr<HiZBuffer> hiz_buffer_ = nullptr;
+    std::unique_ptr<OccluderPrepass> occluder_prepass_ = nullptr;
 
-    std::unique_ptr<GlBuffer> camera_info_buffer_ = nullptr;
-    std::unique_ptr<GlProgram> node_cull_program_ = nullptr;
-    std::unique_ptr<GlProgram> init_buffer_program_ = nullptr;
-    std::unique_ptr<GlProgram> calc_args_program_ = nullptr;
+    std::unique_ptr<HierarchyCuller> culler_ = nullptr;
 
+    // instances of a node are the range [first_instance, first_instance + num_instances) of the instances
+    // sorted by morton code, empty children are -1
     struct OctreeNode {
         Bbox bbox;
-        std::vector<uint32_t> instances;
+        uint32_t first_instance;
+        uint32_t num_instances;
         int ch[8];
         uint32_t level;
 
-        OctreeNode(Bbox bbox);
+        OctreeNode(Bbox bbox, uint32_t first_instance, uint32_t num_instances, uint32_t level);
 
-        bool IsLeaf() const { return ch[0] == -1; }
+        bool IsLeaf() const;
     };
     std::vector<OctreeNode> octree_nodes_;
     
     uint32_t octree_max_level_ = 0;
-    std::unique_ptr<GlBuffer> dispatch_args_buffer_ = nullptr;
-    std::unique_ptr<GlBuffer> octree_buffer_ = nullptr;
-    std::unique_ptr<GlBuffer> io_nodes_buffer_[2];
-    std::unique_ptr<GlBuffer> visible_nodes_buffer_ = nullptr;
 
     uint32_t num_drawn_instances_ = 0;
 };
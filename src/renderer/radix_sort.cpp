@@ -0,0 +1,109 @@
+#include "radix_sort.hpp"
+
+#include <vector>
+
+#include <glad/glad.h>
+
+#include "rasterizer/utils.hpp"
+
+namespace {
+
+constexpr uint32_t kRadixBits = 8;
+constexpr uint32_t kRadixSize = 1 << kRadixBits;
+constexpr uint32_t kBlockSize = 256;
+constexpr uint32_t kMaxPasses = 64 / kRadixBits;
+
+struct SortParams {
+    uint32_t shift;
+    uint32_t num_blocks;
+    uint32_t key_word;
+    uint32_t num_key_words;
+};
+
+}
+
+RadixSort::RadixSort(uint32_t max_elements, uint32_t max_key_bits) {
+    CreateComputeProgram(count_program_, kShaderSourceDir / "radix_sort/count.comp");
+    CreateComputeProgram(scan_program_, kShaderSourceDir / "radix_sort/scan.comp");
+    CreateComputeProgram(scatter_program_, kShaderSourceDir / "radix_sort/scatter.comp");
+
+    num_blocks_ = std::max((max_elements + kBlockSize - 1) / kBlockSize, 1u);
+    for (size_t i = 0; i < 2; i++) {
+        keys_buffer_[i] = std::make_unique<GlBuffer>(num_blocks_ * kBlockSize * sizeof(uint32_t));
+        values_buffer_[i] = std::make_unique<GlBuffer>(num_blocks_ * kBlockSize * sizeof(uint32_t));
+        if (max_key_bits > 32) {
+            high_keys_buffer_[i] = std::make_unique<GlBuffer>(num_blocks_ * kBlockSize * sizeof(uint32_t));
+        }
+    }
+    count_buffer_ = std::make_unique<GlBuffer>(sizeof(uint32_t));
+    block_counts_buffer_ = std::make_unique<GlBuffer>(kRadixSize * num_blocks_ * sizeof(uint32_t));
+
+    int alignment = 0;
+    glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+    params_stride_ = std::max(static_cast<uint32_t>(alignment), static_cast<uint32_t>(sizeof(SortParams)));
+    std::vector<uint8_t> params(params_stride_ * kMaxPasses);
+    for (uint32_t pass = 0; pass < kMaxPasses; pass++) {
+        *reinterpret_cast<SortParams *>(params.data() + pass * params_stride_) = SortParams {
+            .shift = pass * kRadixBits % 32,
+            .num_blocks = num_blocks_,
+            .key_word = pass * kRadixBits / 32,
+            .num_key_words = high_keys_buffer_[0] ? 2u : 1u,
+        };
+    }
+    params_buffer_ = std::make_unique<GlBuffer>(params.size(), 0, params.data());
+}
+
+void RadixSort::Sort(uint32_t key_bits) {
+    const uint32_t max_passes = high_keys_buffer_[0] ? kMaxPasses : kMaxPasses / 2;
+    const uint32_t num_passes = std::min((key_bits + kRadixBits - 1) / kRadixBits, max_passes);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, count_buffer_->Id());
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, block_counts_buffer_->Id());
+
+    size_t curr = 0;
+    for (uint32_t pass = 0; pass < num_passes; pass++) {
+        glBindBufferRange(GL_UNIFORM_BUFFER, 1, params_buffer_->Id(), pass * params_stride_, sizeof(SortParams));
+        // the passes over the upper 32 bits count the digits of the high keys
+        const auto &count_keys = pass * kRadixBits < 32 ? keys_buffer_ : high_keys_buffer_;
+
+        glUseProgram(count_program_->Id());
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, count_keys[curr]->Id());
+        glDispatchCompute(num_blocks_, 1, 1);
+        glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+        glUseProgram(scan_program_->Id());
+        glDispatchCompute(1, 1, 1);
+        glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+        glUseProgram(scatter_program_->Id());
+        uint32_t scatter_buffers[] = {
+            keys_buffer_[curr]->Id(),
+            values_buffer_[curr]->Id(),
+            keys_buffer_[curr ^ 1]->Id(),
+            values_buffer_[curr ^ 1]->Id(),
+        };
+        glBindBuffersBase(GL_SHADER_STORAGE_BUFFER, 3, 4, scatter_buffers);
+        if (high_keys_buffer_[0]) {
+            uint32_t scatter_high_buffers[] = {
+                high_keys_buffer_[curr]->Id(),
+                high_keys_buffer_[curr ^ 1]->Id(),
+            };
+            glBindBuffersBase(GL_SHADER_STORAGE_BUFFER, 7, 2, scatter_high_buffers);
+        }
+        glDispatchCompute(num_blocks_, 1, 1);
+        glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT | GL_BUFFER_UPDATE_BARRIER_BIT);
+
+        curr ^= 1;
+    }
+
+    // the sorted elements end up in the first buffers
+    if (curr != 0) {
+        glCopyNamedBufferSubData(keys_buffer_[1]->Id(), keys_buffer_[0]->Id(), 0, 0, keys_buffer_[0]->Size());
+        glCopyNamedBufferSubData(values_buffer_[1]->Id(), values_buffer_[0]->Id(), 0, 0, values_buffer_[0]->Size());
+        if (high_keys_buffer_[0]) {
+            glCopyNamedBufferSubData(high_keys_buffer_[1]->Id(), high_keys_buffer_[0]->Id(), 0, 0,
+                high_keys_buffer_[0]->Size());
+        }
+    }
+
+    glUseProgram(0);
+}
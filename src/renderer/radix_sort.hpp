@@ -0,0 +1,40 @@
+#pragma once
+
+#include <memory>
+
+#include "glh/program.hpp"
+#include "glh/resource.hpp"
+
+// Stable LSD radix sort of uint keys with uint values on the GPU, 8 bits per pass.
+// Keys and values are written to KeyBuffer() and ValueBuffer() and the number of elements to the first uint of
+// CountBuffer(), so that they can be produced by a shader, and are sorted in place.
+// Keys of more than 32 bits keep their upper 32 bits in HighKeyBuffer().
+class RadixSort {
+public:
+    explicit RadixSort(uint32_t max_elements, uint32_t max_key_bits = 32);
+
+    const GlBuffer *KeyBuffer() const { return keys_buffer_[0].get(); }
+    // nullptr for keys of at most 32 bits
+    const GlBuffer *HighKeyBuffer() const { return high_keys_buffer_[0].get(); }
+    const GlBuffer *ValueBuffer() const { return values_buffer_[0].get(); }
+    const GlBuffer *CountBuffer() const { return count_buffer_.get(); }
+
+    // sorts by the lowest `key_bits` bits of the keys
+    void Sort(uint32_t key_bits);
+
+private:
+    std::unique_ptr<GlProgram> count_program_ = nullptr;
+    std::unique_ptr<GlProgram> scan_program_ = nullptr;
+    std::unique_ptr<GlProgram> scatter_program_ = nullptr;
+
+    uint32_t num_blocks_ = 0;
+    uint32_t params_stride_ = 0;
+
+    std::unique_ptr<GlBuffer> keys_buffer_[2] = {};
+    std::unique_ptr<GlBuffer> high_keys_buffer_[2] = {};
+    std::unique_ptr<GlBuffer> values_buffer_[2] = {};
+    std::unique_ptr<GlBuffer> count_buffer_ = nullptr;
+    std::unique_ptr<GlBuffer> block_counts_buffer_ = nullptr;
+    // the params of every pass, `params_stride_` bytes apart
+    std::unique_ptr<GlBuffer> params_buffer_ = nullptr;
+};
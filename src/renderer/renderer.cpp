@@ -3,6 +3,8 @@
 #include "basic.hpp"
 #include "simple_hiz.hpp"
 #include "octree_hiz.hpp"
+#include "cluster_hiz.hpp"
+#include "bvh_hiz.hpp"
 
 std::unique_ptr<Renderer> Renderer::CreateRenderer(Rasterizer &rasterizer, const Scene &scene, RendererType type) {
     switch (type) {
@@ -12,6 +14,14 @@ std::unique_ptr<Renderer> Renderer::CreateRenderer(Rasterizer &rasterizer, const
             return std::make_unique<SimpleHiZRenderer>(rasterizer, scene);
         case RendererType::eOctreeHiZ:
             return std::make_unique<OctreeHiZRenderer>(rasterizer, scene);
+        case RendererType::eClusterHiZ:
+            return std::make_unique<ClusterHiZRenderer>(rasterizer, scene);
+        case RendererType::eBvhHiZ:
+            return std::make_unique<BvhHiZRenderer>(rasterizer, scene);
     }
     abort();
 }
+
+float Renderer::LodPixelScale() const {
+    return rasterizer_.GetMatrixProj()[1][1] * rasterizer_.GetDepthTarget()->Height() * 0.5f;
+}
@@ -7,12 +7,16 @@ enum struct RendererType {
     eBasic,
     eSimpleHiZ,
     eOctreeHiZ,
+    eClusterHiZ,
+    eBvhHiZ,
 };
 
-inline constexpr const char *kRendererTypeName[3] = {
+inline constexpr const char *kRendererTypeName[5] = {
     "Basic",
     "Simple Hi-Z",
     "Octree Hi-Z",
+    "Cluster Hi-Z",
+    "BVH Hi-Z",
 };
 
 class Renderer {
@@ -24,10 +28,41 @@ public:
 
     virtual void DrawUi() {}
 
+    // called after `instances` are moved, added or removed in the scene, in ascending order
+    virtual void UpdateInstances(const std::vector<uint32_t> &instances) {}
+
+    // global quality setting of contribution culling, scales the per-model pixel thresholds and 0 disables it
+    void SetContributionCullScale(float scale) { contribution_cull_scale_ = scale; }
+    // instances use the coarsest lod whose error stays within this many pixels, 0 keeps the full models
+    void SetMaxLodError(float pixels) { max_lod_error_ = pixels; }
+    // visible instances are drawn from the nearest to the farthest, so that more fragments fail the depth test
+    void SetFrontToBack(bool enable) { front_to_back_ = enable; }
+
     static std::unique_ptr<Renderer> CreateRenderer(Rasterizer &rasterizer, const Scene &scene,
         RendererType type = RendererType::eBasic);
 
 protected:
+    // pixels covered by a unit length at distance 1 from the camera
+    float LodPixelScale() const;
+
+    // uploads `make_value(i)` to the element i of `buffer` for the ascending `instances`,
+    // runs of consecutive instances are uploaded together
+    template <typename T, typename F>
+    void UploadInstanceRuns(const GlBuffer *buffer, const std::vector<uint32_t> &instances, F make_value) {
+        std::vector<T> values;
+        for (size_t first = 0, last = 0; first < instances.size(); first = last) {
+            values.clear();
+            do {
+                values.push_back(make_value(instances[last++]));
+            } while (last < instances.size() && instances[last] == instances[last - 1] + 1);
+            rasterizer_.UploadBuffer(buffer, instances[first] * sizeof(T), values.size() * sizeof(T), values.data());
+        }
+    }
+
     Rasterizer &rasterizer_;
     const Scene &scene_;
+
+    float contribution_cull_scale_ = 1.0f;
+    float max_lod_error_ = 1.0f;
+    bool front_to_back_ = false;
 };
@@ -1,9 +1,13 @@
 #include "simple_hiz.hpp"
 
+#include <algorithm>
+#include <bit>
+
 #include <glad/glad.h>
 #include <imgui.h>
 
 #include "rasterizer/utils.hpp"
+#include "lod.hpp"
 
 namespace {
 
@@ -11,25 +15,54 @@ struct CullResults {
     uint32_t num_total;
     uint32_t num_visible;
     uint32_t num_culled;
+    uint32_t num_contribution_culled;
 };
 
 struct alignas(16) CullParams {
-    glm::mat4 view;
-    glm::mat4 proj;
-    uint32_t index_offset;
+    glm::mat4 view_proj;
+    float min_pixel_area_scale;
+    float lod_pixel_scale;
+    float max_lod_error;
+    float impostor_distance;
+    uint32_t sort_draws;
+};
+
+struct DrawArguments {
+    uint32_t num_indices;
+    uint32_t first_index;
+    uint32_t vertex_offset;
+    uint32_t instance_count;
+    uint32_t first_instance;
+};
+
+struct DispatchArguments {
+    uint32_t num_work_groups_x;
+    uint32_t num_work_groups_y;
+    uint32_t num_work_groups_z;
 };
 
 constexpr uint32_t kComputeWorkGroupSize = 256;
+// frames the stats can be behind before the readback waits for the GPU
+constexpr uint32_t kStatsReadbackCopies = 3;
+
+// model of the free instance slots of the scene, they are skipped by the culling
+constexpr uint32_t kDeadInstanceModel = 0xffffffff;
+
+struct InstanceBbox {
+    glm::vec3 pmin;
+    glm::vec3 pmax;
+};
 
 }
 
 SimpleHiZRenderer::SimpleHiZRenderer(Rasterizer &rasterizer, const Scene &scene) : Renderer(rasterizer, scene) {
     CreateComputeProgram(fill_id_map_program_, kShaderSourceDir / "simple_hiz/fill_inst_id_map.comp");
-    CreateComputeProgram(hiz_gen_program_, kShaderSourceDir / "hiz_gen.comp");
     CreateComputeProgram(hiz_cull_program_, kShaderSourceDir / "simple_hiz/cull.comp");
+    CreateComputeProgram(calc_args_program_, kShaderSourceDir / "simple_hiz/calc_args.comp");
+    CreateComputeProgram(sorted_draws_program_, kShaderSourceDir / "simple_hiz/sorted_draws.comp");
 
     bbox_buffer_ = std::make_unique<GlBuffer>(scene.InstancesCount() * sizeof(float) * 6,
-        GL_MAP_READ_BIT | GL_MAP_WRITE_BIT);
+        GL_MAP_READ_BIT | GL_MAP_WRITE_BIT | GL_DYNAMIC_STORAGE_BIT);
     auto p_bbox = bbox_buffer_->TypedMap<float>(true);
     scene.ForEachInstance([&p_bbox](const Scene::Instance &inst, const Model &model) {
         *p_bbox++ = inst.bbox.pmin.x;
@@ -41,171 +74,297 @@ SimpleHiZRenderer::SimpleHiZRenderer(Rasterizer &rasterizer, const Scene &scene)
     });
     bbox_buffer_->Unmap();
 
-    output_instances_.resize(scene.InstancesCount());
-    instances_id_map_buffer_ = std::make_unique<GlBuffer>(scene.InstancesCount() * sizeof(uint32_t), GL_MAP_READ_BIT);
-    output_instance_buffer_ = std::make_unique<GlBuffer>(scene.InstancesCount() * sizeof(uint32_t), GL_MAP_READ_BIT);
-    cull_result_buffer_ = std::make_unique<GlBuffer>(3 * sizeof(uint32_t), GL_MAP_READ_BIT | GL_MAP_WRITE_BIT);
+    std::vector<float> min_pixel_areas;
+    scene.ForEachInstance([&](const Scene::Instance &inst, const Model &model) {
+        min_pixel_areas.push_back(scene.ModelMinPixelArea(inst.model));
+    });
+    min_pixel_area_buffer_ = std::make_unique<GlBuffer>(min_pixel_areas.size() * sizeof(float), 0,
+        min_pixel_areas.data());
+
+    std::vector<uint32_t> instance_models;
+    model_instances_count_.resize(scene.ModelsCount(), 0);
+    scene.ForEachInstance([&](const Scene::Instance &inst, const Model &model) {
+        instance_models.push_back(inst.alive ? inst.model : kDeadInstanceModel);
+        ++model_instances_count_[inst.model];
+    });
+    instance_model_buffer_ = std::make_unique<GlBuffer>(instance_models.size() * sizeof(uint32_t), 0,
+        instance_models.data());
+    model_lod_buffer_ = CreateModelLodBuffer(scene);
+
+    std::vector<Rasterizer::InstanceTransform> transforms;
+    scene.ForEachInstance([&](const Scene::Instance &inst, const Model &model) {
+        transforms.push_back(Rasterizer::MakeInstanceTransform(inst.transform));
+    });
+    transform_buffer_ = std::make_unique<GlBuffer>(transforms.size() * sizeof(Rasterizer::InstanceTransform),
+        GL_DYNAMIC_STORAGE_BIT, transforms.data());
+
+    // visible instances are gathered into per model and lod ranges of the draw list
+    std::vector<DrawArguments> draw_args(scene.ModelsCount() * Model::kMaxLods, DrawArguments {});
+    uint32_t first_instance = 0;
+    for (size_t i = 0; i < scene.ModelsCount(); i++) {
+        const auto &model = scene.GetModel(i);
+        const auto &lods = model.Lods();
+        for (size_t lod = 0; lod < lods.size(); lod++) {
+            draw_args[i * Model::kMaxLods + lod] = DrawArguments {
+                .num_indices = lods[lod].num_indices,
+                .first_index = model.FirstIndex() + lods[lod].first_index,
+                .vertex_offset = model.VertexOffset(),
+                .instance_count = 0,
+                .first_instance = first_instance,
+            };
+            first_instance += model_instances_count_[i];
+        }
+    }
+    init_draw_args_buffer_ = std::make_unique<GlBuffer>(draw_args.size() * sizeof(DrawArguments), 0,
+        draw_args.data());
+    draw_list_buffer_ = std::make_unique<GlBuffer>(first_instance * sizeof(uint32_t));
+    for (size_t pass = 0; pass < 2; pass++) {
+        draw_args_buffer_[pass] = std::make_unique<GlBuffer>(draw_args.size() * sizeof(DrawArguments));
+        cull_result_buffer_[pass] = std::make_unique<GlBuffer>(sizeof(CullResults));
+        impostor_list_buffer_[pass] = std::make_unique<GlBuffer>(scene.InstancesCount() * sizeof(uint32_t));
+        impostor_args_buffer_[pass] = std::make_unique<GlBuffer>(sizeof(DispatchArguments));
+    }
+    dispatch_args_buffer_ = std::make_unique<GlBuffer>(sizeof(DispatchArguments));
+    // visible instances are sorted by their draw followed by 16 bits of view depth
+    draw_sort_key_bits_ = 16 + std::bit_width(static_cast<uint32_t>(draw_args.size() - 1));
+    draw_sort_ = std::make_unique<RadixSort>(scene.InstancesCount(), draw_sort_key_bits_);
+
+    instances_id_map_buffer_ = std::make_unique<GlBuffer>(scene.InstancesCount() * sizeof(uint32_t));
+    output_instance_buffer_ = std::make_unique<GlBuffer>(scene.InstancesCount() * sizeof(uint32_t));
+
+    camera_info_buffer_ = std::make_unique<GlBuffer>(sizeof(CullParams));
+
+    stats_readback_ = std::make_unique<GlReadbackBuffer>(2 * (sizeof(CullResults)
+        + draw_args.size() * sizeof(DrawArguments) + sizeof(DispatchArguments)), kStatsReadbackCopies);
 
-    camera_info_buffer_ = std::make_unique<GlBuffer>(sizeof(CullParams), GL_DYNAMIC_STORAGE_BIT);
+    hiz_buffer_ = std::make_unique<HiZBuffer>();
+    occluder_prepass_ = std::make_unique<OccluderPrepass>(scene);
+    impostors_ = std::make_unique<ImpostorAtlas>(scene);
 }
 
 void SimpleHiZRenderer::RenderScene() {
+    PollStats();
+
     auto depth_buffer = rasterizer_.GetDepthTarget();
-    bool can_do_cull = true;
-    if (!prev_depth_ || prev_depth_->Width() != depth_buffer->Width()
-        || prev_depth_->Height() != depth_buffer->Height()) {
-        prev_depth_ = std::make_unique<GlTexture2D>(depth_buffer->Format(), depth_buffer->Width(),
-            depth_buffer->Height(), 0);
-        can_do_cull = false;
+    bool has_prev_depth = true;
+    if (hiz_buffer_->Width() != depth_buffer->Width() || hiz_buffer_->Height() != depth_buffer->Height()) {
+        hiz_buffer_->Resize(depth_buffer->Width(), depth_buffer->Height());
+        has_prev_depth = false;
+    }
+    // without depth of the previous frame, the Hi-Z buffer is built from the occluders of this frame
+    if (!has_prev_depth || occluder_prepass_->EveryFrame()) {
+        occluder_prepass_->Render(rasterizer_, *hiz_buffer_);
     }
 
     CullResults cull_res {
         .num_total = static_cast<uint32_t>(scene_.InstancesCount()),
         .num_visible = 0,
         .num_culled = 0,
+        .num_contribution_culled = 0,
     };
-    if (can_do_cull) {
-        auto p_cull_res = cull_result_buffer_->TypedMap<CullResults>(true);
-        *p_cull_res = cull_res;
-        cull_result_buffer_->Unmap();
-
-        glUseProgram(fill_id_map_program_->Id());
-        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, instances_id_map_buffer_->Id());
-        glBindBufferRange(GL_UNIFORM_BUFFER, 1, cull_result_buffer_->Id(), 0, sizeof(uint32_t));
-        glDispatchCompute((scene_.InstancesCount() + kComputeWorkGroupSize - 1) / kComputeWorkGroupSize, 1, 1);
-        glUseProgram(0);
-
-        CullParams camera {
-            .view = rasterizer_.GetMatrixView(),
-            .proj = rasterizer_.GetMatrixProj(),
-            .index_offset = 0,
-        };
-        glNamedBufferSubData(camera_info_buffer_->Id(), 0, sizeof(CullParams), &camera);
-
-        glUseProgram(hiz_cull_program_->Id());
-
-        glBindTextureUnit(0, prev_depth_->Id());
+    rasterizer_.UploadBuffer(cull_result_buffer_[0].get(), 0, sizeof(CullResults), &cull_res);
+    const DispatchArguments no_impostors { 0, 1, 1 };
+    for (size_t pass = 0; pass < 2; pass++) {
+        rasterizer_.UploadBuffer(impostor_args_buffer_[pass].get(), 0, sizeof(DispatchArguments), &no_impostors);
+    }
+    glCopyNamedBufferSubData(init_draw_args_buffer_->Id(), draw_args_buffer_[0]->Id(), 0, 0,
+        init_draw_args_buffer_->Size());
 
-        uint32_t storage_buffers[] = {
-            bbox_buffer_->Id(),
-            instances_id_map_buffer_->Id(),
-            output_instance_buffer_->Id(),
-            cull_result_buffer_->Id(),
-        };
-        glBindBuffersBase(GL_SHADER_STORAGE_BUFFER, 1, 4, storage_buffers);
-        glBindBufferBase(GL_UNIFORM_BUFFER, 5, camera_info_buffer_->Id());
+    glUseProgram(fill_id_map_program_->Id());
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, instances_id_map_buffer_->Id());
+    glBindBufferRange(GL_UNIFORM_BUFFER, 1, cull_result_buffer_[0]->Id(), 0, sizeof(uint32_t));
+    glDispatchCompute((scene_.InstancesCount() + kComputeWorkGroupSize - 1) / kComputeWorkGroupSize, 1, 1);
+    glUseProgram(0);
 
-        glDispatchCompute((scene_.InstancesCount() + kComputeWorkGroupSize - 1) / kComputeWorkGroupSize, 1, 1);
+    CullParams camera {
+        .view_proj = rasterizer_.GetMatrixProj() * rasterizer_.GetMatrixView(),
+        .min_pixel_area_scale = contribution_cull_scale_,
+        .lod_pixel_scale = LodPixelScale(),
+        .max_lod_error = max_lod_error_,
+        .impostor_distance = impostor_distance_,
+        // the number of words of the sort keys
+        .sort_draws = front_to_back_ ? (draw_sort_key_bits_ > 32 ? 2u : 1u) : 0u,
+    };
+    rasterizer_.UploadBuffer(camera_info_buffer_.get(), 0, sizeof(CullParams), &camera);
+    glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+    Cull(0, instances_id_map_buffer_.get(), output_instance_buffer_.get());
+    DrawVisibleInstances(0);
+
+    hiz_buffer_->Generate(depth_buffer);
+
+    // occluded instances are tested again with the depth of the visible ones, the draws of the second pass start
+    // after the instances drawn by the first one
+    glUseProgram(calc_args_program_->Id());
+    uint32_t calc_args_buffers[] = {
+        cull_result_buffer_[0]->Id(),
+        cull_result_buffer_[1]->Id(),
+        dispatch_args_buffer_->Id(),
+        init_draw_args_buffer_->Id(),
+        draw_args_buffer_[0]->Id(),
+        draw_args_buffer_[1]->Id(),
+    };
+    glBindBuffersBase(GL_SHADER_STORAGE_BUFFER, 0, 6, calc_args_buffers);
+    glDispatchCompute((scene_.ModelsCount() * Model::kMaxLods + kComputeWorkGroupSize - 1) / kComputeWorkGroupSize,
+        1, 1);
+    glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT | GL_COMMAND_BARRIER_BIT);
 
-        glUseProgram(0);
+    Cull(1, output_instance_buffer_.get(), instances_id_map_buffer_.get());
+    DrawVisibleInstances(1);
 
-        cull_res = *cull_result_buffer_->TypedMap<CullResults>();
-        cull_result_buffer_->Unmap();
+    hiz_buffer_->Generate(depth_buffer);
 
-        auto output = output_instance_buffer_->TypedMap<uint32_t>();
-        std::copy_n(output, scene_.InstancesCount(), output_instances_.data());
-        output_instance_buffer_->Unmap();
-    } else {
-        cull_res.num_visible = cull_res.num_total;
-        for (uint32_t i = 0; i < scene_.InstancesCount(); i++) {
-            output_instances_[i] = i;
-        }
+    uint64_t offset = 0;
+    for (size_t pass = 0; pass < 2; pass++) {
+        stats_readback_->Copy(cull_result_buffer_[pass]->Id(), 0, offset, sizeof(CullResults));
+        offset += sizeof(CullResults);
     }
+    for (size_t pass = 0; pass < 2; pass++) {
+        stats_readback_->Copy(draw_args_buffer_[pass]->Id(), 0, offset, draw_args_buffer_[pass]->Size());
+        offset += draw_args_buffer_[pass]->Size();
+    }
+    for (size_t pass = 0; pass < 2; pass++) {
+        stats_readback_->Copy(impostor_args_buffer_[pass]->Id(), 0, offset, sizeof(DispatchArguments));
+        offset += sizeof(DispatchArguments);
+    }
+    stats_readback_->Submit();
+}
 
-    for (uint32_t i = 0; i < cull_res.num_visible; i++) {
-        const auto &inst = scene_.GetInstance(output_instances_[i]);
-        const auto &model = scene_.GetModel(inst.model);
-
-        rasterizer_.SetMatrixModel(inst.transform);
-        rasterizer_.SetPositionBuffer(model.PositionBuffer());
-        rasterizer_.SetNormalBuffer(model.NormalBuffer());
-        rasterizer_.SetIndexBuffer(model.IndexBuffer());
-        rasterizer_.DrawIndexed(model.IndicesCount());
-    }
-    num_drawn_instances_ = cull_res.num_visible;
-    
-    GenerateHiZ();
-
-    if (cull_res.num_culled > 0) {
-        auto offset = cull_res.num_visible;
-        cull_res.num_total = cull_res.num_culled;
-        cull_res.num_culled = 0;
-        cull_res.num_visible = 0;
-        auto p_cull_res = cull_result_buffer_->TypedMap<CullResults>(true);
-        *p_cull_res = cull_res;
-        cull_result_buffer_->Unmap();
-
-        CullParams camera {
-            .view = rasterizer_.GetMatrixView(),
-            .proj = rasterizer_.GetMatrixProj(),
-            .index_offset = offset,
-        };
-        glNamedBufferSubData(camera_info_buffer_->Id(), 0, sizeof(CullParams), &camera);
-
-        glUseProgram(hiz_cull_program_->Id());
-
-        glBindTextureUnit(0, prev_depth_->Id());
+void SimpleHiZRenderer::DrawUi() {
+    PollStats();
+    ImGui::Text("Culling: %d / %d", num_drawn_instances_, static_cast<uint32_t>(scene_.AliveInstancesCount()));
+    ImGui::Text("Contribution culled: %d", num_contribution_culled_);
+    ImGui::Text("Triangles: %d", num_drawn_triangles_);
+    ImGui::Text("Impostors: %d", num_drawn_impostors_);
+    ImGui::SliderFloat("Impostor distance", &impostor_distance_, 0.0f, 1000.0f);
+    occluder_prepass_->DrawUi();
+}
 
-        uint32_t storage_buffers[] = {
-            bbox_buffer_->Id(),
-            output_instance_buffer_->Id(),
-            instances_id_map_buffer_->Id(),
-            cull_result_buffer_->Id(),
-        };
-        glBindBuffersBase(GL_SHADER_STORAGE_BUFFER, 1, 4, storage_buffers);
-        glBindBufferBase(GL_UNIFORM_BUFFER, 5, camera_info_buffer_->Id());
+void SimpleHiZRenderer::Cull(uint32_t pass, const GlBuffer *in_instances, const GlBuffer *out_instances) {
+    uint32_t zero = 0;
+    if (front_to_back_) {
+        glClearNamedBufferData(draw_sort_->CountBuffer()->Id(), GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, &zero);
+    }
 
-        glDispatchCompute((cull_res.num_total + kComputeWorkGroupSize - 1) / kComputeWorkGroupSize, 1, 1);
+    glUseProgram(hiz_cull_program_->Id());
 
-        glUseProgram(0);
+    hiz_buffer_->Bind(0, 6);
 
-        cull_res = *cull_result_buffer_->TypedMap<CullResults>();
-        cull_result_buffer_->Unmap();
+    uint32_t storage_buffers[] = {
+        bbox_buffer_->Id(),
+        in_instances->Id(),
+        out_instances->Id(),
+        cull_result_buffer_[pass]->Id(),
+    };
+    glBindBuffersBase(GL_SHADER_STORAGE_BUFFER, 1, 4, storage_buffers);
+    glBindBufferBase(GL_UNIFORM_BUFFER, 5, camera_info_buffer_->Id());
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 7, min_pixel_area_buffer_->Id());
+    uint32_t draw_buffers[] = {
+        instance_model_buffer_->Id(),
+        model_lod_buffer_->Id(),
+        draw_args_buffer_[pass]->Id(),
+        draw_list_buffer_->Id(),
+        impostor_args_buffer_[pass]->Id(),
+        impostor_list_buffer_[pass]->Id(),
+        draw_sort_->CountBuffer()->Id(),
+        draw_sort_->KeyBuffer()->Id(),
+        draw_sort_->ValueBuffer()->Id(),
+    };
+    glBindBuffersBase(GL_SHADER_STORAGE_BUFFER, 8, 9, draw_buffers);
+    if (draw_sort_->HighKeyBuffer()) {
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 17, draw_sort_->HighKeyBuffer()->Id());
+    }
 
-        auto output = instances_id_map_buffer_->TypedMap<uint32_t>();
-        std::copy_n(output, cull_res.num_visible, output_instances_.data());
-        instances_id_map_buffer_->Unmap();
+    // the second pass culls the instances occluded in the first one, their number is only known on the GPU
+    if (pass == 0) {
+        glDispatchCompute((scene_.InstancesCount() + kComputeWorkGroupSize - 1) / kComputeWorkGroupSize, 1, 1);
+    } else {
+        glBindBuffer(GL_DISPATCH_INDIRECT_BUFFER, dispatch_args_buffer_->Id());
+        glDispatchComputeIndirect(0);
+        glBindBuffer(GL_DISPATCH_INDIRECT_BUFFER, 0);
+    }
+    glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT | GL_COMMAND_BARRIER_BIT);
 
-        for (uint32_t i = 0; i < cull_res.num_visible; i++) {
-            const auto &inst = scene_.GetInstance(output_instances_[i]);
-            const auto &model = scene_.GetModel(inst.model);
+    // the sorted instances are drawn instead of the draw list, each draw starts at its first sorted instance
+    if (front_to_back_) {
+        draw_sort_->Sort(draw_sort_key_bits_);
 
-            rasterizer_.SetMatrixModel(inst.transform);
-            rasterizer_.SetPositionBuffer(model.PositionBuffer());
-            rasterizer_.SetNormalBuffer(model.NormalBuffer());
-            rasterizer_.SetIndexBuffer(model.IndexBuffer());
-            rasterizer_.DrawIndexed(model.IndicesCount());
+        glUseProgram(sorted_draws_program_->Id());
+        glBindBufferBase(GL_UNIFORM_BUFFER, 5, camera_info_buffer_->Id());
+        uint32_t sorted_draws_buffers[] = {
+            draw_sort_->CountBuffer()->Id(),
+            draw_sort_->KeyBuffer()->Id(),
+            draw_args_buffer_[pass]->Id(),
+        };
+        glBindBuffersBase(GL_SHADER_STORAGE_BUFFER, 0, 3, sorted_draws_buffers);
+        if (draw_sort_->HighKeyBuffer()) {
+            glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, draw_sort_->HighKeyBuffer()->Id());
         }
-
-        GenerateHiZ();
-
-        num_drawn_instances_ += cull_res.num_visible;
+        glDispatchCompute((scene_.InstancesCount() + kComputeWorkGroupSize - 1) / kComputeWorkGroupSize, 1, 1);
+        glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT | GL_COMMAND_BARRIER_BIT);
     }
-}
 
-void SimpleHiZRenderer::DrawUi() {
-    ImGui::Text("Culling: %d / %d", num_drawn_instances_, static_cast<uint32_t>(scene_.InstancesCount()));
+    glUseProgram(0);
 }
 
-void SimpleHiZRenderer::GenerateHiZ() {
-    glCopyImageSubData(rasterizer_.GetDepthTarget()->Id(), GL_TEXTURE_2D, 0, 0, 0, 0,
-        prev_depth_->Id(), GL_TEXTURE_2D, 0, 0, 0, 0, prev_depth_->Width(), prev_depth_->Height(), 1);
+void SimpleHiZRenderer::DrawVisibleInstances(uint32_t pass) {
+    rasterizer_.SetTransformBuffer(transform_buffer_.get());
+    rasterizer_.SetInstanceBuffer(front_to_back_ ? draw_sort_->ValueBuffer() : draw_list_buffer_.get());
+    const auto &geometry = scene_.GetGeometryPool();
+    rasterizer_.SetPositionBuffer(geometry.PositionBuffer());
+    rasterizer_.SetNormalBuffer(geometry.NormalBuffer());
+    rasterizer_.SetIndexBuffer(geometry.IndexBuffer());
+    for (size_t i = 0; i < scene_.ModelsCount(); i++) {
+        if (model_instances_count_[i] == 0) {
+            continue;
+        }
+        // every instance is drawn with one lod, so the lods of a model are drawn in one call
+        const auto &model = scene_.GetModel(i);
+        uint32_t max_indices = 0;
+        for (size_t lod = 0; lod < model.LodsCount(); lod++) {
+            max_indices = std::max(max_indices, model.Lods()[lod].num_indices);
+        }
+        rasterizer_.MultiDrawIndexedInstancedIndirect(draw_args_buffer_[pass].get(),
+            i * Model::kMaxLods * sizeof(DrawArguments), static_cast<uint32_t>(model.LodsCount()), max_indices,
+            model_instances_count_[i]);
+    }
 
-    glUseProgram(hiz_gen_program_->Id());
+    // the atlas is only baked once impostors are turned on
+    if (impostor_distance_ > 0.0f) {
+        impostors_->Draw(rasterizer_, impostor_list_buffer_[pass].get(), impostor_args_buffer_[pass].get());
+    }
+}
 
-    uint32_t level = 0;
-    uint32_t width = prev_depth_->Width();
-    uint32_t height = prev_depth_->Height();
-    while (width > 1 || height > 1) {
-        ++level;
-        width = width == 1 ? 1 : width / 2;
-        height = height == 1 ? 1 : height / 2;
+bool SimpleHiZRenderer::PollStats() {
+    if (!stats_readback_->Poll()) {
+        return false;
+    }
 
-        glBindImageTexture(0, prev_depth_->Id(), level - 1, GL_FALSE, 0, GL_READ_ONLY, GL_R32I);
-        glBindImageTexture(1, prev_depth_->Id(), level, GL_FALSE, 0, GL_WRITE_ONLY, GL_R32I);
-        glDispatchCompute((width + 15) / 16, (height + 15) / 16, 1);
-        glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+    auto p_results = stats_readback_->TypedData<CullResults>();
+    num_drawn_instances_ = p_results[0].num_visible + p_results[1].num_visible;
+    num_contribution_culled_ = p_results[0].num_contribution_culled + p_results[1].num_contribution_culled;
+    const size_t num_draws = scene_.ModelsCount() * Model::kMaxLods;
+    auto p_draw_args = reinterpret_cast<const DrawArguments *>(p_results + 2);
+    num_drawn_triangles_ = 0;
+    for (size_t i = 0; i < 2 * num_draws; i++) {
+        num_drawn_triangles_ += p_draw_args[i].instance_count * (p_draw_args[i].num_indices / 3);
     }
+    auto p_impostor_args = reinterpret_cast<const DispatchArguments *>(p_draw_args + 2 * num_draws);
+    num_drawn_impostors_ = p_impostor_args[0].num_work_groups_x + p_impostor_args[1].num_work_groups_x;
+    return true;
+}
 
-    glUseProgram(0);
+void SimpleHiZRenderer::UpdateInstances(const std::vector<uint32_t> &instances) {
+    UploadInstanceRuns<InstanceBbox>(bbox_buffer_.get(), instances, [this](uint32_t inst_id) {
+        const auto &bbox = scene_.GetInstance(inst_id).bbox;
+        return InstanceBbox { bbox.pmin, bbox.pmax };
+    });
+    UploadInstanceRuns<Rasterizer::InstanceTransform>(transform_buffer_.get(), instances, [this](uint32_t inst_id) {
+        return Rasterizer::MakeInstanceTransform(scene_.GetInstance(inst_id).transform);
+    });
+    UploadInstanceRuns<uint32_t>(instance_model_buffer_.get(), instances, [this](uint32_t inst_id) {
+        const auto &inst = scene_.GetInstance(inst_id);
+        return inst.alive ? inst.model : kDeadInstanceModel;
+    });
+    impostors_->UpdateInstances(instances);
 }
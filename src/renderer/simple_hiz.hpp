@@ -1,6 +1,11 @@
 #pragma once
 
 #include "renderer.hpp"
+#include "hiz.hpp"
+#include "occluder_prepass.hpp"
+#include "impostor.hpp"
+#include "radix_sort.hpp"
+#include "glh/readback_buffer.hpp"
 
 class SimpleHiZRenderer final : public Renderer {
 public:
@@ -10,21 +15,60 @@ public:
 
     void DrawUi() override;
 
+    void UpdateInstances(const std::vector<uint32_t> &instances) override;
+
 private:
-    void GenerateHiZ();
+    // culls the instances listed in `in_instances` and gathers the visible ones into the draws of `pass`,
+    // the occluded ones are written to `out_instances`
+    void Cull(uint32_t pass, const GlBuffer *in_instances, const GlBuffer *out_instances);
+    // draws the instances gathered by `pass` with the lods picked by the cull pass, one indirect draw per model and
+    // lod. the ones marked as impostors are drawn from the impostor atlas
+    void DrawVisibleInstances(uint32_t pass);
+    // reads the stats of an earlier frame back without waiting, returns true if they were updated
+    bool PollStats();
 
     std::unique_ptr<GlProgram> fill_id_map_program_ = nullptr;
-    std::unique_ptr<GlProgram> hiz_gen_program_ = nullptr;
     std::unique_ptr<GlProgram> hiz_cull_program_ = nullptr;
+    std::unique_ptr<GlProgram> calc_args_program_ = nullptr;
+    std::unique_ptr<GlProgram> sorted_draws_program_ = nullptr;
 
-    std::unique_ptr<GlTexture2D> prev_depth_ = nullptr;
+    std::unique_ptr<HiZBuffer> hiz_buffer_ = nullptr;
+    std::unique_ptr<OccluderPrepass> occluder_prepass_ = nullptr;
+    std::unique_ptr<ImpostorAtlas> impostors_ = nullptr;
 
     std::unique_ptr<GlBuffer> bbox_buffer_ = nullptr;
+    std::unique_ptr<GlBuffer> min_pixel_area_buffer_ = nullptr;
+    std::unique_ptr<GlBuffer> instance_model_buffer_ = nullptr;
+    std::unique_ptr<GlBuffer> model_lod_buffer_ = nullptr;
     std::unique_ptr<GlBuffer> instances_id_map_buffer_ = nullptr;
-    std::vector<uint32_t> output_instances_;
+    std::unique_ptr<GlBuffer> transform_buffer_ = nullptr;
     std::unique_ptr<GlBuffer> output_instance_buffer_ = nullptr;
-    std::unique_ptr<GlBuffer> cull_result_buffer_ = nullptr;
     std::unique_ptr<GlBuffer> camera_info_buffer_ = nullptr;
 
+    // instance slots of every model, a draw of a model never has more instances
+    std::vector<uint32_t> model_instances_count_;
+    // the draw of lod `l` of model `m` is `m * Model::kMaxLods + l`, each pass has its own draw arguments and cull
+    // results. the draws of the second pass continue the draw list after the instances of the first pass
+    std::unique_ptr<GlBuffer> init_draw_args_buffer_ = nullptr;
+    std::unique_ptr<GlBuffer> draw_args_buffer_[2] = {};
+    std::unique_ptr<GlBuffer> draw_list_buffer_ = nullptr;
+    std::unique_ptr<GlBuffer> cull_result_buffer_[2] = {};
+    // dispatch arguments of the second cull pass
+    std::unique_ptr<GlBuffer> dispatch_args_buffer_ = nullptr;
+    // instances drawn as impostors by each pass and the dispatch arguments of their draws
+    std::unique_ptr<GlBuffer> impostor_list_buffer_[2] = {};
+    std::unique_ptr<GlBuffer> impostor_args_buffer_[2] = {};
+    uint32_t draw_sort_key_bits_ = 0;
+    std::unique_ptr<RadixSort> draw_sort_ = nullptr;
+
+    // the cull results of both passes followed by their draw arguments and impostor dispatch arguments
+    std::unique_ptr<GlReadbackBuffer> stats_readback_ = nullptr;
+
     uint32_t num_drawn_instances_ = 0;
+    uint32_t num_drawn_triangles_ = 0;
+    uint32_t num_contribution_culled_ = 0;
+    uint32_t num_drawn_impostors_ = 0;
+
+    // view space depth beyond which instances are drawn as impostors, 0 disables impostors
+    float impostor_distance_ = 0.0f;
 };
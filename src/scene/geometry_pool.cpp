@@ -0,0 +1,110 @@
+#include "geometry_pool.hpp"
+
+#include <algorithm>
+
+#include <glad/glad.h>
+
+GeometryPool::FreeList::FreeList(uint32_t capacity) : capacity_(capacity) {
+    if (capacity > 0) {
+        free_ranges_[0] = capacity;
+    }
+}
+
+bool GeometryPool::FreeList::Allocate(uint32_t size, uint32_t &offset) {
+    if (size == 0) {
+        offset = 0;
+        return true;
+    }
+    auto it = std::find_if(free_ranges_.begin(), free_ranges_.end(), [size](const auto &range) {
+        return range.second >= size;
+    });
+    if (it == free_ranges_.end()) {
+        return false;
+    }
+    offset = it->first;
+    const auto remaining = it->second - size;
+    free_ranges_.erase(it);
+    if (remaining > 0) {
+        free_ranges_[offset + size] = remaining;
+    }
+    return true;
+}
+
+void GeometryPool::FreeList::Free(uint32_t offset, uint32_t size) {
+    if (size == 0) {
+        return;
+    }
+    auto next = free_ranges_.lower_bound(offset);
+    if (next != free_ranges_.end() && offset + size == next->first) {
+        size += next->second;
+        next = free_ranges_.erase(next);
+    }
+    if (next != free_ranges_.begin()) {
+        auto prev = std::prev(next);
+        if (prev->first + prev->second == offset) {
+            prev->second += size;
+            return;
+        }
+    }
+    free_ranges_[offset] = size;
+}
+
+void GeometryPool::FreeList::Grow(uint32_t capacity) {
+    const auto old_capacity = capacity_;
+    capacity_ = capacity;
+    Free(old_capacity, capacity - old_capacity);
+}
+
+GeometryPool::GeometryPool(uint32_t vertex_capacity, uint32_t index_capacity)
+    : vertex_ranges_(vertex_capacity), index_ranges_(index_capacity) {
+    position_buffer_ = std::make_unique<GlBuffer>(std::max(vertex_capacity, 1u) * sizeof(glm::vec3),
+        GL_DYNAMIC_STORAGE_BIT);
+    normal_buffer_ = std::make_unique<GlBuffer>(std::max(vertex_capacity, 1u) * sizeof(glm::vec3),
+        GL_DYNAMIC_STORAGE_BIT);
+    index_buffer_ = std::make_unique<GlBuffer>(std::max(index_capacity, 1u) * sizeof(uint32_t),
+        GL_DYNAMIC_STORAGE_BIT);
+}
+
+GeometryPool::Allocation GeometryPool::Allocate(const std::vector<glm::vec3> &positions,
+    const std::vector<glm::vec3> &normals, const std::vector<uint32_t> &indices) {
+    Allocation allocation {
+        .vertex_offset = 0,
+        .num_vertices = static_cast<uint32_t>(positions.size()),
+        .first_index = 0,
+        .num_indices = static_cast<uint32_t>(indices.size()),
+    };
+
+    // the buffers at least double, so that streaming many models in doesn't copy them every time
+    while (!vertex_ranges_.Allocate(allocation.num_vertices, allocation.vertex_offset)) {
+        const auto capacity = std::max(vertex_ranges_.Capacity() * 2, vertex_ranges_.Capacity()
+            + allocation.num_vertices);
+        GrowBuffer(position_buffer_, capacity * sizeof(glm::vec3));
+        GrowBuffer(normal_buffer_, capacity * sizeof(glm::vec3));
+        vertex_ranges_.Grow(capacity);
+    }
+    while (!index_ranges_.Allocate(allocation.num_indices, allocation.first_index)) {
+        const auto capacity = std::max(index_ranges_.Capacity() * 2, index_ranges_.Capacity()
+            + allocation.num_indices);
+        GrowBuffer(index_buffer_, capacity * sizeof(uint32_t));
+        index_ranges_.Grow(capacity);
+    }
+
+    glNamedBufferSubData(position_buffer_->Id(), allocation.vertex_offset * sizeof(glm::vec3),
+        positions.size() * sizeof(glm::vec3), positions.data());
+    glNamedBufferSubData(normal_buffer_->Id(), allocation.vertex_offset * sizeof(glm::vec3),
+        normals.size() * sizeof(glm::vec3), normals.data());
+    glNamedBufferSubData(index_buffer_->Id(), allocation.first_index * sizeof(uint32_t),
+        indices.size() * sizeof(uint32_t), indices.data());
+    return allocation;
+}
+
+void GeometryPool::Free(const Allocation &allocation) {
+    vertex_ranges_.Free(allocation.vertex_offset, allocation.num_vertices);
+    index_ranges_.Free(allocation.first_index, allocation.num_indices);
+}
+
+void GeometryPool::GrowBuffer(std::unique_ptr<GlBuffer> &buffer, uint64_t size) {
+    auto new_buffer = std::make_unique<GlBuffer>(size, GL_DYNAMIC_STORAGE_BIT);
+    glCopyNamedBufferSubData(buffer->Id(), new_buffer->Id(), 0, 0, buffer->Size());
+    buffer = std::move(new_buffer);
+}
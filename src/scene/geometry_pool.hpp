@@ -0,0 +1,59 @@
+#pragma once
+
+#include <map>
+#include <memory>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "glh/resource.hpp"
+
+// Vertices and indices of all models, suballocated from one position, one normal and one index buffer.
+// Geometry is bound once and draws pick a model by vertex_offset and first_index, indices stay relative to the
+// first vertex of their model. Freed ranges are reused by later allocations, the buffers grow when none fits.
+class GeometryPool {
+public:
+    struct Allocation {
+        uint32_t vertex_offset;
+        uint32_t num_vertices;
+        uint32_t first_index;
+        uint32_t num_indices;
+    };
+
+    GeometryPool(uint32_t vertex_capacity, uint32_t index_capacity);
+
+    Allocation Allocate(const std::vector<glm::vec3> &positions, const std::vector<glm::vec3> &normals,
+        const std::vector<uint32_t> &indices);
+    void Free(const Allocation &allocation);
+
+    const GlBuffer *PositionBuffer() const { return position_buffer_.get(); }
+    const GlBuffer *NormalBuffer() const { return normal_buffer_.get(); }
+    const GlBuffer *IndexBuffer() const { return index_buffer_.get(); }
+
+private:
+    // first fit over the free ranges ordered by offset, adjacent ranges are merged when freed
+    class FreeList {
+    public:
+        explicit FreeList(uint32_t capacity);
+
+        uint32_t Capacity() const { return capacity_; }
+        // returns false if no free range is large enough
+        bool Allocate(uint32_t size, uint32_t &offset);
+        void Free(uint32_t offset, uint32_t size);
+        void Grow(uint32_t capacity);
+
+    private:
+        uint32_t capacity_;
+        std::map<uint32_t, uint32_t> free_ranges_;
+    };
+
+    // reallocates `buffer` with `size` bytes and keeps its content
+    static void GrowBuffer(std::unique_ptr<GlBuffer> &buffer, uint64_t size);
+
+    FreeList vertex_ranges_;
+    FreeList index_ranges_;
+
+    std::unique_ptr<GlBuffer> position_buffer_;
+    std::unique_ptr<GlBuffer> normal_buffer_;
+    std::unique_ptr<GlBuffer> index_buffer_;
+};
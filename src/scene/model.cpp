@@ -1,12 +1,24 @@
 #include "model.hpp"
 
+#include <algorithm>
 #include <iostream>
+#include <queue>
 #include <unordered_map>
+#include <unordered_set>
 
 #include <tiny_obj_loader.h>
 
 namespace {
 
+constexpr size_t kMeshletMaxTriangles = 128;
+
+// each lod targets half the triangles of the previous one, down to this many triangles
+constexpr size_t kLodMinTriangles = 16;
+// a collapse is rejected if it turns a triangle by more than this, cosine of the angle
+constexpr double kLodMinNormalCos = 0.2;
+// weight of the planes that keep open borders in place
+constexpr double kLodBorderWeight = 10.0;
+
 size_t HashCombine(size_t seed, size_t v) {
     seed ^= v + 0x9e3779b9 + (seed << 6) + (seed >> 2);
     return seed;
@@ -26,6 +38,72 @@ void FetchVertexData(const tinyobj::attrib_t &in_attribs, const tinyobj::index_t
     }
 }
 
+// vertices split by different normals or texcoords share the same position id
+size_t WeldPositions(const std::vector<glm::vec3> &positions, std::vector<uint32_t> &position_ids) {
+    std::vector<uint32_t> sorted_vertices(positions.size());
+    for (size_t i = 0; i < positions.size(); i++) {
+        sorted_vertices[i] = i;
+    }
+    std::sort(sorted_vertices.begin(), sorted_vertices.end(), [&positions](uint32_t a, uint32_t b) {
+        const auto &pa = positions[a];
+        const auto &pb = positions[b];
+        return pa.x != pb.x ? pa.x < pb.x : pa.y != pb.y ? pa.y < pb.y : pa.z < pb.z;
+    });
+    position_ids.resize(positions.size());
+    size_t num_positions = 0;
+    for (size_t i = 0; i < sorted_vertices.size(); i++) {
+        if (i > 0 && positions[sorted_vertices[i]] != positions[sorted_vertices[i - 1]]) {
+            ++num_positions;
+        }
+        position_ids[sorted_vertices[i]] = num_positions;
+    }
+    return positions.empty() ? 0 : num_positions + 1;
+}
+
+// sum of squared distances to a set of planes, as the upper triangle of a symmetric 4x4 matrix
+struct Quadric {
+    double a[10] {};
+
+    static Quadric FromPlane(const glm::dvec3 &n, double d, double weight) {
+        Quadric q;
+        q.a[0] = n.x * n.x * weight;
+        q.a[1] = n.x * n.y * weight;
+        q.a[2] = n.x * n.z * weight;
+        q.a[3] = n.x * d * weight;
+        q.a[4] = n.y * n.y * weight;
+        q.a[5] = n.y * n.z * weight;
+        q.a[6] = n.y * d * weight;
+        q.a[7] = n.z * n.z * weight;
+        q.a[8] = n.z * d * weight;
+        q.a[9] = d * d * weight;
+        return q;
+    }
+
+    Quadric &operator+=(const Quadric &rhs) {
+        for (size_t i = 0; i < 10; i++) {
+            a[i] += rhs.a[i];
+        }
+        return *this;
+    }
+
+    double Evaluate(const glm::dvec3 &p) const {
+        return a[0] * p.x * p.x + 2.0 * a[1] * p.x * p.y + 2.0 * a[2] * p.x * p.z + 2.0 * a[3] * p.x
+            + a[4] * p.y * p.y + 2.0 * a[5] * p.y * p.z + 2.0 * a[6] * p.y
+            + a[7] * p.z * p.z + 2.0 * a[8] * p.z + a[9];
+    }
+};
+
+// moves position `from` onto position `to`, entries are stale once either position changed
+struct Collapse {
+    double cost;
+    uint32_t from;
+    uint32_t to;
+    uint32_t from_version;
+    uint32_t to_version;
+
+    bool operator>(const Collapse &rhs) const { return cost > rhs.cost; }
+};
+
 }
 
 bool operator==(const tinyobj::index_t &a, const tinyobj::index_t &b) noexcept {
@@ -124,10 +202,362 @@ Model::Model(const std::filesystem::path &obj_path) {
             norm = glm::normalize(norm);
         }
     }
-    
-    size_t vertex_buffer_size = positions_.size() * sizeof(glm::vec3);
-    position_buffer_ = std::make_unique<GlBuffer>(vertex_buffer_size, false, positions_.data());
-    normal_buffer_ = std::make_unique<GlBuffer>(vertex_buffer_size, false, normals_.data());
-    size_t index_buffer_size = indices_.size() * sizeof(uint32_t);
-    index_buffer_ = std::make_unique<GlBuffer>(index_buffer_size, false, indices_.data());
+
+    BuildMeshlets();
+    BuildLods();
+}
+
+Model::Model(std::vector<glm::vec3> positions, std::vector<glm::vec3> normals, std::vector<uint32_t> indices)
+    : positions_(std::move(positions)), normals_(std::move(normals)), indices_(std::move(indices)) {
+    bbox_.Empty();
+    for (const auto &pos : positions_) {
+        bbox_.Merge(pos);
+    }
+
+    BuildMeshlets();
+    BuildLods();
+}
+
+void Model::SetGeometry(const GeometryPool *pool, const GeometryPool::Allocation &allocation) {
+    geometry_pool_ = pool;
+    geometry_ = allocation;
+}
+
+void Model::BuildMeshlets() {
+    const size_t num_triangles = indices_.size() / 3;
+
+    // vertices split by different normals or texcoords still connect their triangles
+    std::vector<uint32_t> position_ids;
+    const size_t num_positions = WeldPositions(positions_, position_ids);
+
+    std::vector<uint32_t> position_tri_offsets(num_positions + 1, 0);
+    for (auto index : indices_) {
+        ++position_tri_offsets[position_ids[index] + 1];
+    }
+    for (size_t i = 0; i < num_positions; i++) {
+        position_tri_offsets[i + 1] += position_tri_offsets[i];
+    }
+    std::vector<uint32_t> position_tris(indices_.size());
+    std::vector<uint32_t> position_tri_counts(num_positions, 0);
+    for (size_t i = 0; i < indices_.size(); i++) {
+        auto id = position_ids[indices_[i]];
+        position_tris[position_tri_offsets[id] + position_tri_counts[id]++] = i / 3;
+    }
+
+    // grow each meshlet from a seed triangle through shared vertices so that meshlets are compact patches
+    std::vector<uint32_t> meshlet_indices;
+    meshlet_indices.reserve(indices_.size());
+    std::vector<bool> used(num_triangles, false);
+    for (size_t seed = 0; seed < num_triangles; seed++) {
+        if (used[seed]) {
+            continue;
+        }
+
+        Meshlet meshlet {};
+        meshlet.first_index = meshlet_indices.size();
+
+        std::queue<uint32_t> frontier;
+        frontier.push(seed);
+        while (!frontier.empty() && meshlet.num_indices < kMeshletMaxTriangles * 3) {
+            auto tri = frontier.front();
+            frontier.pop();
+            if (used[tri]) {
+                continue;
+            }
+            used[tri] = true;
+            for (size_t i = 0; i < 3; i++) {
+                auto index = indices_[tri * 3 + i];
+                meshlet_indices.push_back(index);
+                auto id = position_ids[index];
+                for (auto j = position_tri_offsets[id]; j < position_tri_offsets[id + 1]; j++) {
+                    if (!used[position_tris[j]]) {
+                        frontier.push(position_tris[j]);
+                    }
+                }
+            }
+            meshlet.num_indices += 3;
+        }
+
+        struct Bbox bbox {};
+        bbox.Empty();
+        glm::vec3 normal_sum(0.0f);
+        for (size_t i = meshlet.first_index; i < meshlet_indices.size(); i += 3) {
+            auto p0 = positions_[meshlet_indices[i]];
+            auto p1 = positions_[meshlet_indices[i + 1]];
+            auto p2 = positions_[meshlet_indices[i + 2]];
+            bbox.Merge(p0);
+            bbox.Merge(p1);
+            bbox.Merge(p2);
+            auto n = glm::cross(p1 - p0, p2 - p0);
+            auto n_len = glm::length(n);
+            if (n_len > 0.0f) {
+                normal_sum += n / n_len;
+            }
+        }
+        meshlet.bbox_min = bbox.pmin;
+        meshlet.bbox_max = bbox.pmax;
+        meshlet.center = bbox.Centroid();
+        meshlet.radius = 0.0f;
+        for (size_t i = meshlet.first_index; i < meshlet_indices.size(); i++) {
+            meshlet.radius = std::max(meshlet.radius, glm::length(positions_[meshlet_indices[i]] - meshlet.center));
+        }
+
+        // a cone wider than a half space can't be back facing as a whole, cutoff 1 disables the test
+        meshlet.cone_axis = glm::vec3(0.0f, 0.0f, 1.0f);
+        meshlet.cone_cutoff = 1.0f;
+        auto normal_sum_len = glm::length(normal_sum);
+        if (normal_sum_len > 0.0f) {
+            auto axis = normal_sum / normal_sum_len;
+            float min_cos = 1.0f;
+            for (size_t i = meshlet.first_index; i < meshlet_indices.size(); i += 3) {
+                auto p0 = positions_[meshlet_indices[i]];
+                auto n = glm::cross(positions_[meshlet_indices[i + 1]] - p0, positions_[meshlet_indices[i + 2]] - p0);
+                auto n_len = glm::length(n);
+                if (n_len > 0.0f) {
+                    min_cos = std::min(min_cos, glm::dot(axis, n / n_len));
+                }
+            }
+            if (min_cos > 0.0f) {
+                meshlet.cone_axis = axis;
+                meshlet.cone_cutoff = std::sqrt(std::max(1.0f - min_cos * min_cos, 0.0f));
+            }
+        }
+
+        meshlets_.push_back(meshlet);
+    }
+
+    indices_ = std::move(meshlet_indices);
+}
+
+// quadric error simplification by collapsing edges onto one of their end points, so every lod indexes the
+// vertices of the full model. the collapses go on from one lod to the next, each lod is a snapshot of them.
+void Model::BuildLods() {
+    lods_.push_back(Lod {
+        .first_index = 0,
+        .num_indices = static_cast<uint32_t>(indices_.size()),
+        .error = 0.0f,
+    });
+
+    // collapses work on positions, so the vertices split by normals at a position move together
+    std::vector<uint32_t> position_ids;
+    const size_t num_positions = WeldPositions(positions_, position_ids);
+    std::vector<glm::dvec3> points(num_positions);
+    std::vector<uint32_t> position_vertex_offsets(num_positions + 1, 0);
+    for (size_t i = 0; i < positions_.size(); i++) {
+        points[position_ids[i]] = positions_[i];
+        ++position_vertex_offsets[position_ids[i] + 1];
+    }
+    for (size_t i = 0; i < num_positions; i++) {
+        position_vertex_offsets[i + 1] += position_vertex_offsets[i];
+    }
+    std::vector<uint32_t> position_vertices(positions_.size());
+    std::vector<uint32_t> position_vertex_counts(num_positions, 0);
+    for (size_t i = 0; i < positions_.size(); i++) {
+        auto id = position_ids[i];
+        position_vertices[position_vertex_offsets[id] + position_vertex_counts[id]++] = i;
+    }
+
+    const size_t num_triangles = indices_.size() / 3;
+    std::vector<glm::uvec3> triangles(num_triangles);
+    std::vector<bool> alive(num_triangles, false);
+    std::vector<std::vector<uint32_t>> position_tris(num_positions);
+    std::vector<Quadric> quadrics(num_positions);
+    std::unordered_map<uint64_t, uint32_t> edge_counts;
+    auto edge_key = [](uint32_t a, uint32_t b) {
+        return (static_cast<uint64_t>(std::min(a, b)) << 32) | std::max(a, b);
+    };
+    auto tri_positions = [&](uint32_t t) {
+        const auto &tri = triangles[t];
+        return glm::uvec3(position_ids[tri.x], position_ids[tri.y], position_ids[tri.z]);
+    };
+    size_t num_alive = 0;
+    for (size_t t = 0; t < num_triangles; t++) {
+        triangles[t] = glm::uvec3(indices_[t * 3], indices_[t * 3 + 1], indices_[t * 3 + 2]);
+        const auto p = tri_positions(t);
+        if (p.x == p.y || p.y == p.z || p.z == p.x) {
+            continue;
+        }
+        alive[t] = true;
+        ++num_alive;
+        auto n = glm::cross(points[p.y] - points[p.x], points[p.z] - points[p.x]);
+        auto n_len = glm::length(n);
+        for (size_t i = 0; i < 3; i++) {
+            if (n_len > 0.0) {
+                quadrics[p[i]] += Quadric::FromPlane(n / n_len, -glm::dot(n / n_len, points[p.x]), 1.0);
+            }
+            position_tris[p[i]].push_back(t);
+            ++edge_counts[edge_key(p[i], p[(i + 1) % 3])];
+        }
+    }
+
+    // open borders are kept in place by planes through the border edges, perpendicular to their triangles
+    for (size_t t = 0; t < num_triangles; t++) {
+        if (!alive[t]) {
+            continue;
+        }
+        const auto p = tri_positions(t);
+        auto n = glm::cross(points[p.y] - points[p.x], points[p.z] - points[p.x]);
+        for (size_t i = 0; i < 3; i++) {
+            const auto a = p[i];
+            const auto b = p[(i + 1) % 3];
+            if (edge_counts[edge_key(a, b)] != 1) {
+                continue;
+            }
+            auto border_n = glm::cross(points[b] - points[a], n);
+            auto border_n_len = glm::length(border_n);
+            if (border_n_len > 0.0) {
+                border_n /= border_n_len;
+                auto border_plane = Quadric::FromPlane(border_n, -glm::dot(border_n, points[a]), kLodBorderWeight);
+                quadrics[a] += border_plane;
+                quadrics[b] += border_plane;
+            }
+        }
+    }
+
+    std::vector<uint32_t> versions(num_positions, 0);
+    std::vector<bool> removed(num_positions, false);
+    std::priority_queue<Collapse, std::vector<Collapse>, std::greater<>> collapses;
+    auto push_collapse = [&](uint32_t from, uint32_t to) {
+        auto q = quadrics[from];
+        q += quadrics[to];
+        collapses.push(Collapse { q.Evaluate(points[to]), from, to, versions[from], versions[to] });
+    };
+    for (size_t t = 0; t < num_triangles; t++) {
+        if (alive[t]) {
+            const auto p = tri_positions(t);
+            for (size_t i = 0; i < 3; i++) {
+                push_collapse(p[i], p[(i + 1) % 3]);
+                push_collapse(p[(i + 1) % 3], p[i]);
+            }
+        }
+    }
+
+    // a collapse may neither fold a triangle over nor merge two surfaces that only touch along the edge,
+    // the latter happens when the end points have more common neighbours than the triangles of the edge
+    auto is_valid_collapse = [&](uint32_t from, uint32_t to) {
+        std::unordered_set<uint32_t> from_neighbours;
+        uint32_t num_edge_tris = 0;
+        for (auto t : position_tris[from]) {
+            if (!alive[t]) {
+                continue;
+            }
+            const auto p = tri_positions(t);
+            if (p.x == to || p.y == to || p.z == to) {
+                ++num_edge_tris;
+                continue;
+            }
+            from_neighbours.insert({ p.x, p.y, p.z });
+
+            auto n = glm::cross(points[p.y] - points[p.x], points[p.z] - points[p.x]);
+            glm::dvec3 q[3];
+            for (size_t i = 0; i < 3; i++) {
+                q[i] = p[i] == from ? points[to] : points[p[i]];
+            }
+            auto new_n = glm::cross(q[1] - q[0], q[2] - q[0]);
+            auto n_len = glm::length(n);
+            if (n_len > 0.0 && glm::dot(n, new_n) <= kLodMinNormalCos * n_len * glm::length(new_n)) {
+                return false;
+            }
+        }
+        std::unordered_set<uint32_t> common_neighbours;
+        for (auto t : position_tris[to]) {
+            if (!alive[t]) {
+                continue;
+            }
+            const auto p = tri_positions(t);
+            for (size_t i = 0; i < 3; i++) {
+                if (p[i] != to && p[i] != from && from_neighbours.count(p[i]) > 0) {
+                    common_neighbours.insert(p[i]);
+                }
+            }
+        }
+        return common_neighbours.size() <= num_edge_tris;
+    };
+
+    // of the vertices at the target position, the one whose normal is the closest replaces a moved vertex
+    auto closest_vertex = [&](uint32_t position, uint32_t vertex) {
+        uint32_t best_vertex = position_vertices[position_vertex_offsets[position]];
+        float best_cos = -2.0f;
+        for (auto i = position_vertex_offsets[position]; i < position_vertex_offsets[position + 1]; i++) {
+            float cos = glm::dot(normals_[position_vertices[i]], normals_[vertex]);
+            if (cos > best_cos) {
+                best_cos = cos;
+                best_vertex = position_vertices[i];
+            }
+        }
+        return best_vertex;
+    };
+
+    auto collapse = [&](uint32_t from, uint32_t to) {
+        removed[from] = true;
+        ++versions[from];
+        ++versions[to];
+        quadrics[to] += quadrics[from];
+        for (auto t : position_tris[from]) {
+            if (!alive[t]) {
+                continue;
+            }
+            const auto p = tri_positions(t);
+            if (p.x == to || p.y == to || p.z == to) {
+                alive[t] = false;
+                --num_alive;
+                continue;
+            }
+            for (size_t i = 0; i < 3; i++) {
+                if (p[i] == from) {
+                    triangles[t][i] = closest_vertex(to, triangles[t][i]);
+                }
+            }
+            position_tris[to].push_back(t);
+        }
+        position_tris[from].clear();
+        std::erase_if(position_tris[to], [&alive](uint32_t t) { return !alive[t]; });
+
+        // only the quadric of `to` changed, so only the collapses of its edges need new costs
+        for (auto t : position_tris[to]) {
+            const auto p = tri_positions(t);
+            for (size_t i = 0; i < 3; i++) {
+                if (p[i] != to) {
+                    push_collapse(to, p[i]);
+                    push_collapse(p[i], to);
+                }
+            }
+        }
+    };
+
+    double max_cost = 0.0;
+    while (lods_.size() < kMaxLods) {
+        const size_t prev_triangles = lods_.back().num_indices / 3;
+        const size_t target_triangles = prev_triangles / 2;
+        if (target_triangles < kLodMinTriangles) {
+            break;
+        }
+        while (num_alive > target_triangles && !collapses.empty()) {
+            const auto c = collapses.top();
+            collapses.pop();
+            if (removed[c.from] || removed[c.to] || c.from_version != versions[c.from]
+                || c.to_version != versions[c.to] || !is_valid_collapse(c.from, c.to)) {
+                continue;
+            }
+            max_cost = std::max(max_cost, c.cost);
+            collapse(c.from, c.to);
+        }
+        // the simplification got stuck, a lod that is barely smaller than the previous one isn't worth it
+        if (num_alive * 4 > prev_triangles * 3) {
+            break;
+        }
+
+        Lod lod {
+            .first_index = static_cast<uint32_t>(indices_.size()),
+            .num_indices = static_cast<uint32_t>(num_alive * 3),
+            // squared distances to several planes add up, so this bounds the distance to any of them
+            .error = static_cast<float>(std::sqrt(max_cost)),
+        };
+        for (size_t t = 0; t < num_triangles; t++) {
+            if (alive[t]) {
+                indices_.insert(indices_.end(), { triangles[t].x, triangles[t].y, triangles[t].z });
+            }
+        }
+        lods_.push_back(lod);
+    }
 }
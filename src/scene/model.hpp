@@ -5,31 +5,74 @@
 #include <glm/glm.hpp>
 
 #include "bbox.hpp"
-#include "glh/resource.hpp"
+#include "geometry_pool.hpp"
 
 class Model {
 public:
+    // a cluster of triangles that are stored contiguously in the index buffer
+    struct Meshlet {
+        glm::vec3 center;
+        float radius;
+        // all triangles are back facing when seen from a point p with
+        // dot(center - p, cone_axis) >= cone_cutoff * length(center - p) + radius
+        glm::vec3 cone_axis;
+        float cone_cutoff;
+        glm::vec3 bbox_min;
+        uint32_t first_index;
+        glm::vec3 bbox_max;
+        uint32_t num_indices;
+    };
+
+    // a simplified version of the model, stored as a range of the index buffer that uses the same vertices.
+    // lod 0 is the full model, `error` estimates how far the simplified surface strays from it in model space.
+    struct Lod {
+        uint32_t first_index;
+        uint32_t num_indices;
+        float error;
+    };
+    static constexpr size_t kMaxLods = 8;
+
     Model(const std::filesystem::path &obj_path);
+    // a model of lod 0 geometry built in memory, such as a static batch of the scene
+    Model(std::vector<glm::vec3> positions, std::vector<glm::vec3> normals, std::vector<uint32_t> indices);
 
     size_t VericesCount() const { return positions_.size(); }
     const std::vector<glm::vec3> &Positions() const { return positions_; }
     const std::vector<glm::vec3> &Normals() const { return normals_; }
-    size_t IndicesCount() const { return indices_.size(); }
+    // indices of lod 0, meshlets only cover lod 0
+    size_t IndicesCount() const { return lods_.front().num_indices; }
+    // lod 0 followed by the coarser lods
     const std::vector<uint32_t> &Indices() const { return indices_; }
 
     const Bbox &Bbox() const { return bbox_; }
 
-    const GlBuffer *PositionBuffer() const { return position_buffer_.get(); }
-    const GlBuffer *NormalBuffer() const { return normal_buffer_.get(); }
-    const GlBuffer *IndexBuffer() const { return index_buffer_.get(); }
+    size_t MeshletsCount() const { return meshlets_.size(); }
+    const std::vector<Meshlet> &Meshlets() const { return meshlets_; }
+
+    size_t LodsCount() const { return lods_.size(); }
+    const std::vector<Lod> &Lods() const { return lods_; }
+
+    // the vertices and indices are stored in the geometry pool of the scene, draws of the model pass
+    // VertexOffset() and add FirstIndex() to the first index of a lod or meshlet
+    void SetGeometry(const GeometryPool *pool, const GeometryPool::Allocation &allocation);
+    const GlBuffer *PositionBuffer() const { return geometry_pool_->PositionBuffer(); }
+    const GlBuffer *NormalBuffer() const { return geometry_pool_->NormalBuffer(); }
+    const GlBuffer *IndexBuffer() const { return geometry_pool_->IndexBuffer(); }
+    uint32_t VertexOffset() const { return geometry_.vertex_offset; }
+    uint32_t FirstIndex() const { return geometry_.first_index; }
+    const GeometryPool::Allocation &Geometry() const { return geometry_; }
 
 private:
+    void BuildMeshlets();
+    void BuildLods();
+
     std::vector<glm::vec3> positions_;
     std::vector<glm::vec3> normals_;
     std::vector<uint32_t> indices_;
     struct Bbox bbox_;
+    std::vector<Meshlet> meshlets_;
+    std::vector<Lod> lods_;
 
-    std::unique_ptr<GlBuffer> position_buffer_;
-    std::unique_ptr<GlBuffer> normal_buffer_;
-    std::unique_ptr<GlBuffer> index_buffer_;
+    const GeometryPool *geometry_pool_ = nullptr;
+    GeometryPool::Allocation geometry_ {};
 };
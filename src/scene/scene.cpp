@@ -1,19 +1,40 @@
 #include "scene.hpp"
 
+#include <algorithm>
 #include <iostream>
 #include <fstream>
+#include <limits>
+#include <numeric>
 
 #include <nlohmann/json.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 
+namespace {
+
+constexpr float kDefaultMinPixelArea = 1.0f;
+
+// a model is only batched if a batch can hold at least this many of its instances
+constexpr uint32_t kMinBatchInstances = 4;
+// the centers of the instances of a batch span at most this fraction of the scene extent by default, so that
+// batches stay small enough to be culled
+constexpr float kDefaultBatchExtentFraction = 0.25f;
+
+}
+
 Scene::Scene(const std::filesystem::path &scene_path) {
+    uint32_t batch_max_triangles = 0;
+    float batch_max_extent = 0.0f;
+    std::vector<bool> dynamic_instances;
+    std::vector<uint32_t> model_reserves;
     auto ext = scene_path.extension().string();
     if (ext == ".obj") {
         models_.emplace_back(scene_path);
+        model_min_pixel_areas_.push_back(kDefaultMinPixelArea);
         instances_.push_back(Instance {
             .model = 0,
             .transform = glm::mat4(1.0f),
         });
+        dynamic_instances.push_back(false);
     } else if (ext == ".json") {
         auto scene_json = nlohmann::json::parse(std::ifstream(scene_path));
         auto models_json = scene_json["models"];
@@ -23,7 +44,11 @@ Scene::Scene(const std::filesystem::path &scene_path) {
             auto model_file_path = scene_path;
             model_file_path.replace_filename(model_json["file"]);
             models_.emplace_back(model_file_path);
+            model_min_pixel_areas_.push_back(model_json.value("min_pixel_area", kDefaultMinPixelArea));
+            model_reserves.push_back(model_json.value("reserve", 0u));
         }
+        batch_max_triangles = scene_json.value("batch_max_triangles", 0u);
+        batch_max_extent = scene_json.value("batch_max_extent", 0.0f);
         auto instances_json = scene_json["instances"];
         for (auto &instance_json : instances_json) {
             glm::mat4 trans = glm::mat4(1.0f);
@@ -47,10 +72,38 @@ Scene::Scene(const std::filesystem::path &scene_path) {
                 .model = model_map[instance_json["model"]],
                 .transform = trans,
             });
+            dynamic_instances.push_back(instance_json.value("dynamic", false));
         }
     }
 
+    num_source_instances_ = instances_.size();
+    instance_sources_.resize(instances_.size());
+    std::iota(instance_sources_.begin(), instance_sources_.end(), 0);
+    model_vertex_sources_.resize(models_.size());
+    if (batch_max_triangles > 0) {
+        BuildStaticBatches(batch_max_triangles, batch_max_extent, dynamic_instances);
+    }
+
+    UploadGeometry();
     CalcBbox();
+
+    // free slots follow the loaded instances
+    num_alive_instances_ = instances_.size();
+    model_free_slots_.resize(models_.size());
+    for (size_t model = 0; model < model_reserves.size(); model++) {
+        for (uint32_t i = 0; i < model_reserves[model]; i++) {
+            model_free_slots_[model].push_back(instances_.size());
+            instances_.push_back(Instance {
+                .model = model,
+                .transform = glm::mat4(1.0f),
+                .bbox = models_[model].Bbox(),
+                .alive = false,
+            });
+            instance_sources_.push_back(kNoSourceInstance);
+        }
+    }
+    generations_.resize(instances_.size(), 0);
+    dirty_flags_.resize(instances_.size(), false);
 }
 
 void Scene::ForEachInstance(const std::function<void(const Instance &, const Model &)> &func) const {
@@ -60,6 +113,212 @@ void Scene::ForEachInstance(const std::function<void(const Instance &, const Mod
     }
 }
 
+uint32_t Scene::SourceInstance(size_t i, size_t triangle) const {
+    const auto &inst = instances_[i];
+    const auto &vertex_sources = model_vertex_sources_[inst.model];
+    if (vertex_sources.empty()) {
+        return instance_sources_[i];
+    }
+    // the instances of a batch share no vertices, so any vertex of the triangle tells its source
+    return vertex_sources[models_[inst.model].Indices()[triangle * 3]];
+}
+
+void Scene::SetInstanceTransform(size_t i, const glm::mat4 &transform) {
+    auto &inst = instances_[i];
+    inst.transform = transform;
+    inst.bbox = models_[inst.model].Bbox().TransformBy(transform);
+    bbox_.Merge(inst.bbox);
+    MarkDirty(i);
+}
+
+Scene::InstanceHandle Scene::GetInstanceHandle(size_t i) const {
+    return InstanceHandle {
+        .slot = static_cast<uint32_t>(i),
+        .generation = generations_[i],
+    };
+}
+
+bool Scene::IsValid(InstanceHandle handle) const {
+    return handle.slot < instances_.size() && instances_[handle.slot].alive
+        && generations_[handle.slot] == handle.generation;
+}
+
+Scene::InstanceHandle Scene::AddInstance(size_t model, const glm::mat4 &transform) {
+    auto &free_slots = model_free_slots_[model];
+    if (free_slots.empty()) {
+        return InstanceHandle {};
+    }
+    const auto slot = free_slots.back();
+    free_slots.pop_back();
+    instances_[slot].alive = true;
+    instance_sources_[slot] = kNoSourceInstance;
+    ++num_alive_instances_;
+    SetInstanceTransform(slot, transform);
+    return GetInstanceHandle(slot);
+}
+
+void Scene::RemoveInstance(InstanceHandle handle) {
+    if (!IsValid(handle)) {
+        return;
+    }
+    auto &inst = instances_[handle.slot];
+    inst.alive = false;
+    ++generations_[handle.slot];
+    model_free_slots_[inst.model].push_back(handle.slot);
+    --num_alive_instances_;
+    MarkDirty(handle.slot);
+}
+
+bool Scene::SetTransform(InstanceHandle handle, const glm::mat4 &transform) {
+    if (!IsValid(handle)) {
+        return false;
+    }
+    SetInstanceTransform(handle.slot, transform);
+    return true;
+}
+
+std::vector<uint32_t> Scene::TakeDirtyInstances() {
+    auto dirty_instances = std::move(dirty_instances_);
+    dirty_instances_.clear();
+    for (auto i : dirty_instances) {
+        dirty_flags_[i] = false;
+    }
+    std::sort(dirty_instances.begin(), dirty_instances.end());
+    return dirty_instances;
+}
+
+void Scene::MarkDirty(uint32_t i) {
+    if (!dirty_flags_[i]) {
+        dirty_flags_[i] = true;
+        dirty_instances_.push_back(i);
+    }
+}
+
+void Scene::BuildStaticBatches(uint32_t max_triangles, float max_extent, const std::vector<bool> &dynamic_instances) {
+    const auto num_triangles = [this](uint32_t inst_id) {
+        return static_cast<uint32_t>(models_[instances_[inst_id].model].IndicesCount() / 3);
+    };
+    std::vector<uint32_t> candidates;
+    std::vector<glm::vec3> centers(instances_.size());
+    // the bounds of the scene are only calculated after batching
+    struct Bbox scene_bbox;
+    scene_bbox.Empty();
+    for (uint32_t i = 0; i < instances_.size(); i++) {
+        const auto bbox = models_[instances_[i].model].Bbox().TransformBy(instances_[i].transform);
+        scene_bbox.Merge(bbox);
+        if (!dynamic_instances[i] && num_triangles(i) * kMinBatchInstances <= max_triangles) {
+            candidates.push_back(i);
+            centers[i] = bbox.Centroid();
+        }
+    }
+    if (max_extent <= 0.0f) {
+        max_extent = scene_bbox.Extent() * kDefaultBatchExtentFraction;
+    }
+
+    std::vector<std::pair<size_t, size_t>> groups;
+    std::vector<std::pair<size_t, size_t>> stack { { 0, candidates.size() } };
+    while (!stack.empty()) {
+        const auto [first, last] = stack.back();
+        stack.pop_back();
+        uint32_t group_triangles = 0;
+        struct Bbox bounds;
+        bounds.Empty();
+        for (size_t i = first; i < last; i++) {
+            group_triangles += num_triangles(candidates[i]);
+            bounds.Merge(centers[candidates[i]]);
+        }
+        // groups spread too far apart are split further, down to single instances that are not batched
+        if (group_triangles <= max_triangles && bounds.Extent() <= max_extent) {
+            groups.emplace_back(first, last);
+            continue;
+        }
+        const auto extent = bounds.pmax - bounds.pmin;
+        const int axis = extent.x >= extent.y && extent.x >= extent.z ? 0 : (extent.y >= extent.z ? 1 : 2);
+        const auto mid = first + (last - first) / 2;
+        std::nth_element(candidates.begin() + first, candidates.begin() + mid, candidates.begin() + last,
+            [&](uint32_t a, uint32_t b) { return centers[a][axis] < centers[b][axis]; });
+        stack.emplace_back(first, mid);
+        stack.emplace_back(mid, last);
+    }
+
+    std::vector<bool> batched(instances_.size(), false);
+    std::vector<Instance> batch_instances;
+    size_t num_batched = 0;
+    for (const auto &[first, last] : groups) {
+        if (last - first < 2) {
+            continue;
+        }
+        std::vector<glm::vec3> positions;
+        std::vector<glm::vec3> normals;
+        std::vector<uint32_t> indices;
+        std::vector<uint32_t> vertex_sources;
+        float min_pixel_area = std::numeric_limits<float>::max();
+        for (size_t i = first; i < last; i++) {
+            const auto inst_id = candidates[i];
+            const auto &inst = instances_[inst_id];
+            const auto &model = models_[inst.model];
+            const auto normal_transform = glm::transpose(glm::inverse(glm::mat3(inst.transform)));
+            const auto vertex_offset = static_cast<uint32_t>(positions.size());
+            for (size_t v = 0; v < model.VericesCount(); v++) {
+                positions.push_back(inst.transform * glm::vec4(model.Positions()[v], 1.0f));
+                normals.push_back(glm::normalize(normal_transform * model.Normals()[v]));
+                vertex_sources.push_back(instance_sources_[inst_id]);
+            }
+            // a mirroring transform flips the winding of the triangles
+            const bool flip = glm::determinant(glm::mat3(inst.transform)) < 0.0f;
+            for (size_t t = 0; t < model.IndicesCount(); t += 3) {
+                indices.push_back(vertex_offset + model.Indices()[t]);
+                indices.push_back(vertex_offset + model.Indices()[t + (flip ? 2 : 1)]);
+                indices.push_back(vertex_offset + model.Indices()[t + (flip ? 1 : 2)]);
+            }
+            min_pixel_area = std::min(min_pixel_area, model_min_pixel_areas_[inst.model]);
+            batched[inst_id] = true;
+        }
+        batch_instances.push_back(Instance {
+            .model = models_.size(),
+            .transform = glm::mat4(1.0f),
+            // set by CalcBbox()
+            .bbox = {},
+        });
+        models_.emplace_back(std::move(positions), std::move(normals), std::move(indices));
+        model_min_pixel_areas_.push_back(min_pixel_area);
+        model_vertex_sources_.push_back(std::move(vertex_sources));
+        num_batched += last - first;
+    }
+
+    std::vector<Instance> instances;
+    std::vector<uint32_t> instance_sources;
+    for (size_t i = 0; i < instances_.size(); i++) {
+        if (!batched[i]) {
+            instances.push_back(instances_[i]);
+            instance_sources.push_back(instance_sources_[i]);
+        }
+    }
+    for (const auto &inst : batch_instances) {
+        instances.push_back(inst);
+        instance_sources.push_back(kNoSourceInstance);
+    }
+    instances_ = std::move(instances);
+    instance_sources_ = std::move(instance_sources);
+
+    std::cout << "Static batching: " << num_batched << " instances merged into " << batch_instances.size()
+        << " batches, " << instances_.size() << " instances left" << std::endl;
+}
+
+void Scene::UploadGeometry() {
+    uint32_t num_vertices = 0;
+    uint32_t num_indices = 0;
+    for (const auto &model : models_) {
+        num_vertices += model.VericesCount();
+        num_indices += model.Indices().size();
+    }
+    geometry_pool_ = std::make_unique<GeometryPool>(num_vertices, num_indices);
+    for (auto &model : models_) {
+        model.SetGeometry(geometry_pool_.get(),
+            geometry_pool_->Allocate(model.Positions(), model.Normals(), model.Indices()));
+    }
+}
+
 void Scene::CalcBbox() {
     bbox_.Empty();
     for (auto &inst : instances_) {
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <functional>
+#include <limits>
 
 #include "model.hpp"
 
@@ -10,8 +11,20 @@ public:
         size_t model;
         glm::mat4 transform;
         Bbox bbox;
+        // false for a free slot, renderers skip it
+        bool alive = true;
     };
 
+    // names an instance until it is removed. removing an instance bumps the generation of its slot,
+    // so a handle to a removed instance is rejected even after the slot is reused
+    struct InstanceHandle {
+        uint32_t slot = std::numeric_limits<uint32_t>::max();
+        uint32_t generation = 0;
+    };
+
+    // source of the batch instances and of the instances added at runtime
+    static constexpr uint32_t kNoSourceInstance = std::numeric_limits<uint32_t>::max();
+
     Scene(const std::filesystem::path &scene_path);
 
     Bbox Bbox() const { return bbox_; }
@@ -19,16 +32,66 @@ public:
     float Extent() const { return bbox_.Extent(); }
 
     const Instance &GetInstance(size_t i) const { return instances_[i]; }
+    void SetInstanceTransform(size_t i, const glm::mat4 &transform);
+
+    // instances live in slots that are fixed when the scene is loaded, so that renderers size their buffers once.
+    // "reserve" of a model in a json scene adds that many free slots of the model for AddInstance()
+    InstanceHandle GetInstanceHandle(size_t i) const;
+    bool IsValid(InstanceHandle handle) const;
+    // returns an invalid handle if no slot of the model is free
+    InstanceHandle AddInstance(size_t model, const glm::mat4 &transform);
+    void RemoveInstance(InstanceHandle handle);
+    // returns false if the instance was removed
+    bool SetTransform(InstanceHandle handle, const glm::mat4 &transform);
+    size_t FreeSlotsCount(size_t model) const { return model_free_slots_[model].size(); }
+    size_t AliveInstancesCount() const { return num_alive_instances_; }
+
+    // slots whose instance was moved, added or removed since the last call, in ascending order.
+    // renderers are told about them through Renderer::UpdateInstances()
+    std::vector<uint32_t> TakeDirtyInstances();
+
     const Model &GetModel(size_t i) const { return models_[i]; }
+    // instances of the model covering fewer pixels than this are dropped by contribution culling,
+    // set by "min_pixel_area" of the model in a json scene
+    float ModelMinPixelArea(size_t i) const { return model_min_pixel_areas_[i]; }
+
+    // vertices and indices of all models
+    const GeometryPool &GetGeometryPool() const { return *geometry_pool_; }
 
+    size_t ModelsCount() const { return models_.size(); }
     size_t InstancesCount() const { return instances_.size(); }
     void ForEachInstance(const std::function<void(const Instance &, const Model &)> &func) const;
 
+    // instances of the scene file, before static batching merged some of them
+    size_t SourceInstancesCount() const { return num_source_instances_; }
+    // the instance of the scene file that triangle `triangle` of lod 0 of instance `i` comes from,
+    // kNoSourceInstance for instances added at runtime
+    uint32_t SourceInstance(size_t i, size_t triangle) const;
+
 private:
+    // static instances of models with few triangles are grouped by a median split of their centers until a
+    // group has at most `max_triangles` triangles and its centers span at most `max_extent`, a fraction of the
+    // scene extent if it is 0. every group of more than one instance is merged into a batch model with the
+    // transforms baked in and a single instance
+    void BuildStaticBatches(uint32_t max_triangles, float max_extent, const std::vector<bool> &dynamic_instances);
     void CalcBbox();
+    void MarkDirty(uint32_t i);
+    void UploadGeometry();
 
     std::vector<Model> models_;
+    std::unique_ptr<GeometryPool> geometry_pool_;
+    std::vector<float> model_min_pixel_areas_;
     std::vector<Instance> instances_;
+    // source instance of every instance, or of every vertex of a batch model
+    size_t num_source_instances_ = 0;
+    std::vector<uint32_t> instance_sources_;
+    std::vector<std::vector<uint32_t>> model_vertex_sources_;
+
+    std::vector<uint32_t> generations_;
+    std::vector<std::vector<uint32_t>> model_free_slots_;
+    size_t num_alive_instances_ = 0;
+    std::vector<bool> dirty_flags_;
+    std::vector<uint32_t> dirty_instances_;
     
     struct Bbox bbox_;
 };
@@ -0,0 +1,52 @@
+// Screen space bounds of an axis aligned box, with uv in [0, 1] (y pointing down) and the NDC depth range.
+// The corners are built from the projected centre and half extents, so only one matrix-vector product is needed.
+// A box crossing the camera plane can't be projected, it gets the whole screen and the depth range [-1, 1] instead.
+// Returns false if the box is outside the view frustum.
+bool project_bbox(mat4 view_proj, vec3 bbox_min, vec3 bbox_max,
+    out vec2 uv_min, out vec2 uv_max, out float depth_min, out float depth_max) {
+    const vec4 center = view_proj * vec4((bbox_min + bbox_max) * 0.5, 1.0);
+    const vec3 extent = (bbox_max - bbox_min) * 0.5;
+    const vec4 ex = view_proj[0] * extent.x;
+    const vec4 ey = view_proj[1] * extent.y;
+    const vec4 ez = view_proj[2] * extent.z;
+
+    const float w_radius = abs(ex.w) + abs(ey.w) + abs(ez.w);
+    if (center.w + w_radius <= 0.0) {
+        return false;
+    }
+    if (center.w - w_radius <= 0.0) {
+        uv_min = vec2(0.0);
+        uv_max = vec2(1.0);
+        depth_min = -1.0;
+        depth_max = 1.0;
+        return true;
+    }
+
+    vec3 ndc_min = vec3(1e30);
+    vec3 ndc_max = vec3(-1e30);
+    for (uint i = 0; i < 8; i++) {
+        const vec4 homo = center + ((i & 1) == 0 ? -ex : ex) + ((i & 2) == 0 ? -ey : ey) + ((i & 4) == 0 ? -ez : ez);
+        const vec3 ndc = homo.xyz / homo.w;
+        ndc_min = min(ndc_min, ndc);
+        ndc_max = max(ndc_max, ndc);
+    }
+    uv_min = vec2(ndc_min.x * 0.5 + 0.5, 0.5 - ndc_max.y * 0.5);
+    uv_max = vec2(ndc_max.x * 0.5 + 0.5, 0.5 - ndc_min.y * 0.5);
+    depth_min = ndc_min.z;
+    depth_max = ndc_max.z;
+
+    return all(lessThan(uv_min, vec2(1.0))) && all(greaterThan(uv_max, vec2(0.0)))
+        && depth_max >= -1.0 && depth_min <= 1.0;
+}
+
+// clip space w, i.e. the view space depth, of the point of an axis aligned box nearest to the camera
+float nearest_w(mat4 view_proj, vec3 bbox_min, vec3 bbox_max) {
+    const vec4 w_row = vec4(view_proj[0].w, view_proj[1].w, view_proj[2].w, view_proj[3].w);
+    return dot(w_row, vec4((bbox_min + bbox_max) * 0.5, 1.0)) - dot(abs(w_row.xyz), (bbox_max - bbox_min) * 0.5);
+}
+
+// pixels covered by screen space bounds from project_bbox(), the parts off screen don't count
+float screen_area(vec2 uv_min, vec2 uv_max, vec2 screen_size) {
+    const vec2 size = (clamp(uv_max, 0.0, 1.0) - clamp(uv_min, 0.0, 1.0)) * screen_size;
+    return size.x * size.y;
+}
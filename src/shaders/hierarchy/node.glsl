@@ -0,0 +1,72 @@
+struct Bbox {
+    float min_x;
+    float min_y;
+    float min_z;
+    float max_x;
+    float max_y;
+    float max_z;
+};
+
+// internal nodes only, everything a node test reads sits in one 64 byte line.
+// the bounds of the children are quantized to 8 bits per axis in the frame of the node,
+// the frame starts at `origin` and has a power of two scale per axis.
+// byte `axis * 8 + child` of the child arrays belongs to `child`, empty children have min > max.
+struct HierarchyNode {
+    vec3 origin;
+    uint exps_mask;
+    uint child_min[6];
+    uint child_max[6];
+};
+
+// children of the same kind are consecutive, so a child is found by its rank among them
+struct HierarchyLinks {
+    uint first_internal;
+    uint first_leaf_mask;
+    uint first_instance;
+    uint num_instances;
+};
+
+struct HierarchyLeaf {
+    uint first_instance;
+    uint num_instances;
+};
+
+// range of the proxy mesh indices of an internal node, empty if it has no proxy
+struct HierarchyProxy {
+    uint first_index;
+    uint num_indices;
+};
+
+// marks leaves among the ids of visible and refitted nodes
+#define LEAF_BIT 0x80000000u
+#define EXPONENT_BIAS 127
+
+uint node_child_mask(HierarchyNode node) {
+    return node.exps_mask >> 24;
+}
+
+int node_exponent(HierarchyNode node, uint axis) {
+    return int((node.exps_mask >> (axis * 8)) & 0xffu) - EXPONENT_BIAS;
+}
+
+uint child_byte(uint bytes[6], uint axis, uint child) {
+    const uint i = axis * 8 + child;
+    return (bytes[i >> 2] >> ((i & 3) * 8)) & 0xffu;
+}
+
+void decode_child(HierarchyNode node, uint child, out vec3 bbox_min, out vec3 bbox_max) {
+    for (uint axis = 0; axis < 3; axis++) {
+        const int e = node_exponent(node, axis);
+        bbox_min[axis] = node.origin[axis] + ldexp(float(child_byte(node.child_min, axis, child)), e);
+        bbox_max[axis] = node.origin[axis] + ldexp(float(child_byte(node.child_max, axis, child)), e);
+    }
+}
+
+uint child_id(HierarchyLinks links, uint child_mask, uint child) {
+    const uint leaf_mask = links.first_leaf_mask >> 24;
+    const uint lower_mask = child_mask & ((1u << child) - 1u);
+    if ((leaf_mask & (1u << child)) != 0) {
+        return ((links.first_leaf_mask & 0xffffffu) + bitCount(lower_mask & leaf_mask)) | LEAF_BIT;
+    }
+    return links.first_internal + bitCount(lower_mask & ~leaf_mask);
+}
@@ -0,0 +1,70 @@
+// needs hiz.glsl, bounds.glsl and node.glsl, `view_proj` and `hlod_max_pixels` in scope, the
+// `visible_num` / `visible_nodes` buffer, the `node_proxies` buffer and the `proxy_num` / `proxy_nodes` buffer
+
+#define NODE_CULLED 0
+// the whole subtree is emitted without testing the descendants
+#define NODE_VISIBLE 1
+// the children have to be tested
+#define NODE_TRAVERSE 2
+
+// `pixel_size` is the longest side of the screen space bounds in pixels
+uint test_bbox(vec3 bbox_min, vec3 bbox_max, out float pixel_size) {
+    vec2 uv_min;
+    vec2 uv_max;
+    float depth_min;
+    float depth_max;
+    const bool in_frustum = project_bbox(view_proj, bbox_min, bbox_max, uv_min, uv_max, depth_min, depth_max);
+    const vec2 pixel_extent = (uv_max - uv_min) * vec2(hiz_screen_size);
+    pixel_size = max(pixel_extent.x, pixel_extent.y);
+    if (!in_frustum) {
+        return NODE_CULLED;
+    }
+
+    const uint hiz_result = hiz_classify(uv_min, uv_max, depth_min, depth_max);
+    if (hiz_result == HIZ_OCCLUDED) {
+        return NODE_CULLED;
+    }
+    return hiz_result == HIZ_AMBIGUOUS ? NODE_TRAVERSE : NODE_VISIBLE;
+}
+
+// tests all children of an internal node from its quantized bounds, emits the visible children, the ambiguous
+// leaves and the proxies of small internal children, and returns the mask of the children to traverse
+uint test_children(HierarchyNode node, HierarchyLinks links) {
+    const uint child_mask = node_child_mask(node);
+    const uint leaf_mask = links.first_leaf_mask >> 24;
+    uint traverse_mask = 0;
+    for (uint i = 0; i < 8; i++) {
+        if ((child_mask & (1u << i)) == 0) {
+            continue;
+        }
+        vec3 bbox_min;
+        vec3 bbox_max;
+        decode_child(node, i, bbox_min, bbox_max);
+        // a leaf left empty by moving instances
+        if (bbox_min.x > bbox_max.x) {
+            continue;
+        }
+
+        float pixel_size;
+        const uint result = test_bbox(bbox_min, bbox_max, pixel_size);
+        if (result == NODE_CULLED) {
+            continue;
+        }
+        const bool is_leaf = (leaf_mask & (1u << i)) != 0;
+        if (!is_leaf && pixel_size < hlod_max_pixels) {
+            const uint id = child_id(links, child_mask, i);
+            if (node_proxies[id].num_indices > 0) {
+                const uint idx = atomicAdd(proxy_num, 1);
+                proxy_nodes[idx] = id;
+                continue;
+            }
+        }
+        if (result == NODE_TRAVERSE && !is_leaf) {
+            traverse_mask |= 1u << i;
+        } else {
+            const uint idx = atomicAdd(visible_num, 1);
+            visible_nodes[idx] = child_id(links, child_mask, i);
+        }
+    }
+    return traverse_mask;
+}
@@ -0,0 +1,53 @@
+#define HIZ_MAX_LEVELS 16
+
+struct HiZLevel {
+    ivec2 offset;
+    ivec2 size;
+};
+layout(binding = HIZ_INFO_BINDING) uniform HiZInfo {
+    ivec2 hiz_screen_size;
+    uint hiz_num_levels;
+    uint hiz_num_work_groups;
+    HiZLevel hiz_levels[HIZ_MAX_LEVELS];
+};
+
+#ifdef HIZ_TEXTURE_BINDING
+layout(binding = HIZ_TEXTURE_BINDING) uniform sampler2D hiz_buffer;
+
+#define HIZ_OCCLUDED 0
+#define HIZ_VISIBLE 1
+#define HIZ_AMBIGUOUS 2
+
+// occluded if the box is behind everything in its footprint,
+// visible if it is fully on screen and in front of everything in its footprint
+uint hiz_classify(vec2 uv_min, vec2 uv_max, float depth_min, float depth_max) {
+    const ivec2 pixel_min = ivec2(clamp(uv_min, 0.0, 1.0) * hiz_screen_size);
+    const ivec2 pixel_max = min(ivec2(clamp(uv_max, 0.0, 1.0) * hiz_screen_size), hiz_screen_size - 1);
+
+    // a texel of level `level` covers 2^(level + 1) pixels,
+    // pick the finest level where the footprint touches at most 2x2 texels
+    const ivec2 extent = pixel_max - pixel_min;
+    int level = max(findMSB(max(extent.x, extent.y)), 0);
+    if (level > 0 && all(lessThanEqual((pixel_max >> level) - (pixel_min >> level), ivec2(1)))) {
+        --level;
+    }
+    level = min(level, int(hiz_num_levels) - 1);
+
+    // levels are padded to at least 2x2 texels, so the gathered quad never leaves the level
+    const HiZLevel hiz_level = hiz_levels[level];
+    const ivec2 texel = min(pixel_min >> (level + 1), max(hiz_level.size - 2, 0));
+    const vec2 uv = vec2(hiz_level.offset + texel + 1) / vec2(textureSize(hiz_buffer, 0));
+    const vec4 quad_min = textureGather(hiz_buffer, uv, 0);
+    const vec4 quad_max = textureGather(hiz_buffer, uv, 1);
+    const float hiz_min = min(min(quad_min.x, quad_min.y), min(quad_min.z, quad_min.w));
+    const float hiz_max = max(max(quad_max.x, quad_max.y), max(quad_max.z, quad_max.w));
+
+    if (depth_min >= hiz_max) {
+        return HIZ_OCCLUDED;
+    }
+    if (depth_max < hiz_min && all(greaterThanEqual(uv_min, vec2(0.0))) && all(lessThanEqual(uv_max, vec2(1.0)))) {
+        return HIZ_VISIBLE;
+    }
+    return HIZ_AMBIGUOUS;
+}
+#endif
@@ -0,0 +1,28 @@
+#define MAX_LODS 8
+
+// errors of the lod chain of a model relative to the extent of its bounds, see Model::Lods()
+struct ModelLods {
+    uint num_lods;
+    float errors[MAX_LODS];
+};
+layout(std430, binding = LOD_BINDING) readonly buffer ModelLodBuffer {
+    ModelLods model_lods[];
+};
+
+// the coarsest lod whose error, projected at the nearest point of the instance bounds, is at most `max_error`
+// pixels. `pixel_scale` is the number of pixels covered by a unit length at distance 1 from the camera.
+// errors are scaled by the instance bounds, which never underestimates the scale of a rotated instance.
+uint select_lod(uint model, mat4 view_proj, vec3 bbox_min, vec3 bbox_max, float pixel_scale, float max_error) {
+    const float bbox_w = nearest_w(view_proj, bbox_min, bbox_max);
+    if (bbox_w <= 0.0) {
+        return 0;
+    }
+
+    const float max_relative_error = max_error * bbox_w / (pixel_scale * length(bbox_max - bbox_min));
+    const uint num_lods = model_lods[model].num_lods;
+    uint lod = 0;
+    while (lod + 1 < num_lods && model_lods[model].errors[lod + 1] <= max_relative_error) {
+        ++lod;
+    }
+    return lod;
+}
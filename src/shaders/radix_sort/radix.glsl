@@ -0,0 +1,25 @@
+#define RADIX_BITS 8
+#define RADIX_SIZE 256
+// each work group handles a block of 256 elements
+#define BLOCK_SIZE 256
+
+layout(std430, binding = 0) readonly buffer SortCount {
+    uint sort_count;
+};
+
+// `shift` is within the key word of the pass, 0 for the lower and 1 for the upper 32 bits of the keys
+layout(binding = 1) uniform SortParams {
+    uint shift;
+    uint num_blocks;
+    uint key_word;
+    uint num_key_words;
+};
+
+// the digit counts of all blocks, digit-major so that their exclusive scan is the scatter offset of every block
+layout(std430, binding = 2) buffer BlockCounts {
+    uint block_counts[];
+};
+
+uint radix_digit(uint key) {
+    return (key >> shift) & (RADIX_SIZE - 1);
+}
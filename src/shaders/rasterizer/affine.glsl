@@ -0,0 +1,12 @@
+// affine model matrices are stored as their first 3 rows, see Rasterizer::InstanceTransform
+
+vec3 affine_transform_point(mat3x4 model, vec3 p) {
+    return vec4(p, 1.0) * model;
+}
+
+// inverse transpose of the linear part, the cofactor matrix over the determinant
+mat3 affine_normal_matrix(mat3x4 model) {
+    const mat3 m = transpose(mat3(model));
+    const mat3 cofactor = mat3(cross(m[1], m[2]), cross(m[2], m[0]), cross(m[0], m[1]));
+    return cofactor / dot(m[0], cofactor[0]);
+}
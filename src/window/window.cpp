@@ -8,6 +8,9 @@
 
 namespace {
 
+// an idle window still wakes up a few times per second to keep the ui responsive
+constexpr double kIdleWaitTimeout = 0.1;
+
 void GlfwErrorLogFunc(int error, const char *desc) {
     std::cerr << "glfw error: " << desc << std::endl;
 }
@@ -113,7 +116,11 @@ Window::~Window() {
 
 void Window::MainLoop(const std::function<void()> &func) {
     while (!glfwWindowShouldClose(window_)) {
-        glfwPollEvents();
+        if (idle_) {
+            glfwWaitEventsTimeout(kIdleWaitTimeout);
+        } else {
+            glfwPollEvents();
+        }
 
         ImGui_ImplOpenGL3_NewFrame();
         ImGui_ImplGlfw_NewFrame();
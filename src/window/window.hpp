@@ -28,6 +28,9 @@ public:
 
     void SetTitle(const char *title);
 
+    // an idle window sleeps until an event arrives or a short timeout passes instead of polling every frame
+    void SetIdle(bool idle) { idle_ = idle; }
+
 private:
     friend void GlfwCursorPosCallback(GLFWwindow *window, double x, double y);
     friend void GlfwKeyCallback(GLFWwindow *window, int key, int scancode, int action, int mods);
@@ -45,4 +48,6 @@ private:
     KeyCallback key_callback_ = [](int, int) {};
 
     ResizeCallback resize_callback_ = [](uint32_t, uint32_t) {};
+
+    bool idle_ = false;
 };